@@ -0,0 +1,98 @@
+/*
+  ControlProtocol.h - raw HID control and telemetry protocol
+
+  Shared by the firmware (PS2Control.cpp) and the host tool
+  (extras/degramctl), so it only depends on <stdint.h>.
+
+  Every packet is CTRL_PACKET_SIZE bytes, byte 0 is the command.  The
+  device answers every request with a packet carrying the same command,
+  or CTRL_ERROR.  Multi-byte values are little endian.
+
+     CTRL_GET_MODE   ->  [cmd, mode, number of modes]
+     CTRL_SET_MODE   [cmd, mode]  ->  [cmd, mode, number of modes]
+     CTRL_GET_STATS  ->  stats packet, see CTRL_STAT_* below
+     CTRL_STREAM     [cmd, interval lo, interval hi]  ->  [cmd]
+                     then a stats packet every interval ms, 0 stops it
+     CTRL_SET_TABLE  [cmd, table, offset, length, data...]  ->  [cmd]
+                     the table is used once all of it has been sent
+     CTRL_RESET_TABLE [cmd, table]  ->  [cmd]
+     CTRL_LOAD_TEST  [cmd, pattern, flags, 0, rate, duration ms, seed]
+                     ->  a load packet per mode as each one finishes,
+                     see CTRL_LOAD_* below and PS2LoadGen.h
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef ControlProtocol_h
+#define ControlProtocol_h
+
+#include <stdint.h>
+
+#define CTRL_PACKET_SIZE	64
+
+#define CTRL_GET_MODE		0x01
+#define CTRL_SET_MODE		0x02
+#define CTRL_GET_STATS		0x03
+#define CTRL_STREAM		0x04
+#define CTRL_SET_TABLE		0x05
+#define CTRL_RESET_TABLE	0x06
+#define CTRL_LOAD_TEST		0x07
+#define CTRL_ERROR		0x7F
+
+// Tables that can be uploaded
+#define CTRL_TABLE_TOURETTE	0	// 16 words of 8 USB key codes, 0 ends a word
+
+// Most data bytes in one CTRL_SET_TABLE packet
+#define CTRL_TABLE_CHUNK	(CTRL_PACKET_SIZE - 4)
+
+// Stats packet: 32 bit counters, starting at byte 4
+#define CTRL_STAT_INTERRUPTS	0
+#define CTRL_STAT_FRAMES	1
+#define CTRL_STAT_FRAME_ERRORS	2
+#define CTRL_STAT_RING_DROPS	3
+#define CTRL_STAT_INHIBITS	4
+#define CTRL_STAT_KEYSTROKES	5
+#define CTRL_STAT_REPORTS	6
+#define CTRL_STAT_HISTOGRAM	7	// 8 buckets, keys that took 0..7+ reports
+#define CTRL_STAT_HISTOGRAM_SIZE 8
+#define CTRL_STAT_COUNT		(CTRL_STAT_HISTOGRAM + CTRL_STAT_HISTOGRAM_SIZE)
+
+// Load test request: 32 bit values, starting at byte 4
+#define CTRL_LOAD_RATE		0	// scan codes per second, 0: as fast as possible
+#define CTRL_LOAD_DURATION	1	// ms per mode
+#define CTRL_LOAD_SEED		2
+
+// Load packet: [cmd, mode, number of modes], 32 bit values from byte 4
+#define CTRL_LOAD_SCAN_CODES	0
+#define CTRL_LOAD_KEYS		1
+#define CTRL_LOAD_ELAPSED_US	2
+#define CTRL_LOAD_RING_DROPS	3
+#define CTRL_LOAD_INHIBITS	4
+#define CTRL_LOAD_REPORTS	5
+#define CTRL_LOAD_P50_US	6
+#define CTRL_LOAD_P90_US	7
+#define CTRL_LOAD_P99_US	8
+#define CTRL_LOAD_MAX_US	9
+
+static inline void ctrl_put32(uint8_t *packet, uint8_t index, uint32_t value)
+{
+	uint8_t *p = packet + 4 + 4 * index;
+
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static inline uint32_t ctrl_get32(const uint8_t *packet, uint8_t index)
+{
+	const uint8_t *p = packet + 4 + 4 * index;
+
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#endif
@@ -26,6 +26,9 @@
 */
    
 #include "PS2Keyboard_2.h"
+#include "PS2Control.h"
+#include "PS2Mouse.h"
+#include "PS2LoadGen.h"
 
 const int DataPin = 22;
 const int IRQpin =  0;
@@ -33,14 +36,71 @@ const int LED = 13;
 
 PS2Keyboard keyboard;
 
+#ifdef MOUSE_INTERFACE
+const int MouseDataPin = 23;
+const int MouseIRQpin  = 1;
+
+PS2Mouse mouse;
+bool mouse_present = false;
+#endif
+uint32_t last_report = 0;
+
+#ifndef RAWHID_INTERFACE
+// Runs the synthetic load through every mode and prints what each one
+// sustained.  The keys really get typed, into whatever has the focus.
+void load_test(uint8_t pattern) {
+  PS2LoadConfig_t config = { pattern, 0, 0, 2000, 1 };
+  PS2LoadResult_t r;
+  uint8_t mode = keyboard.getMode();
+
+  Serial.print("load test, pattern ");
+  Serial.println(pattern);
+  for (uint8_t m = 0; m < keyboard.modeCount(); m++) {
+    ps2_load_test(&config, m, &r);
+    Serial.print("mode ");
+    Serial.print(m);
+    Serial.print(": ");
+    Serial.print(r.elapsed_us ? (uint32_t)((uint64_t)r.scan_codes * 1000000 / r.elapsed_us) : 0);
+    Serial.print(" scan codes/s, ");
+    Serial.print(r.keys);
+    Serial.print(" keys, ");
+    Serial.print(r.reports);
+    Serial.print(" reports, ");
+    Serial.print(r.ring_drops);
+    Serial.print(" ring drops, ");
+    Serial.print(r.inhibits);
+    Serial.print(" inhibits, latency us p50 ");
+    Serial.print(r.latency_p50_us);
+    Serial.print(", p90 ");
+    Serial.print(r.latency_p90_us);
+    Serial.print(", p99 ");
+    Serial.print(r.latency_p99_us);
+    Serial.print(", max ");
+    Serial.println(r.latency_max_us);
+  }
+  keyboard.setMode(mode);
+}
+#endif
+
 void setup() {
   pinMode(LED, OUTPUT);
   digitalWrite(LED, HIGH);
   delay(1000);
   digitalWrite(LED, LOW);
   keyboard.begin(DataPin, IRQpin);
+#ifdef MOUSE_INTERFACE
+  mouse_present = mouse.begin(MouseDataPin, MouseIRQpin);
+#endif
+#ifndef RAWHID_INTERFACE
   Serial.begin(9600);
   Serial.println("Keyboard Test:");
+  uint16_t flash_saved, ram_saved;
+  keyboard.tableSavings(&flash_saved, &ram_saved);
+  Serial.print("tables: flash saved ");
+  Serial.print(flash_saved);
+  Serial.print(", RAM saved ");
+  Serial.println(ram_saved);
+#endif
 }
 
 void loop() {
@@ -49,4 +109,40 @@ void loop() {
     // read the next key
     char c = keyboard.read();
   }
+
+#ifdef MOUSE_INTERFACE
+  if (mouse_present) mouse.update();
+#endif
+
+#ifdef RAWHID_INTERFACE
+  // mode, tables and counters are reached with extras/degramctl
+  control_poll();
+#else
+  // a pattern number, 0 to 4 (see PS2LoadGen.h), starts the load test
+  if (Serial.available()) {
+    char p = Serial.read();
+    if (p >= '0' && p < '0' + LOAD_PATTERNS) load_test(p - '0');
+  }
+
+  // every 10 seconds, show how much interrupt work each key press cost
+  if (millis() - last_report > 10000) {
+    PS2Stats_t stats;
+    last_report = millis();
+    keyboard.getStats(&stats);
+    if (stats.keystrokes) {
+      Serial.print("irq/key: ");
+      Serial.println(stats.interrupts / stats.keystrokes);
+    }
+#ifdef MOUSE_INTERFACE
+    if (mouse_present) {
+      PS2MouseStats_t mstats;
+      mouse.getStats(&mstats);
+      Serial.print("mouse packet to report us, avg/max: ");
+      Serial.print(mstats.latency_avg_us);
+      Serial.print("/");
+      Serial.println(mstats.latency_max_us);
+    }
+#endif
+  }
+#endif
 }
@@ -0,0 +1,84 @@
+/*
+  DegramatyzerRules.h - rules of the text modes, in USB key codes
+
+  Shared by the firmware (degramatyzer(), hodorifier(), reverser()) and
+  the offline text engine (extras/degramtext), so it only depends on
+  <stdint.h>.  Key codes are USB usage codes, modifiers the bits of the
+  report's modifier byte.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef DegramatyzerRules_h
+#define DegramatyzerRules_h
+
+#include <stdint.h>
+
+#define RULE_KEY_A		4
+#define RULE_KEY_C		6
+#define RULE_KEY_D		7
+#define RULE_KEY_H		11
+#define RULE_KEY_M		16
+#define RULE_KEY_O		18
+#define RULE_KEY_R		21
+#define RULE_KEY_U		24
+#define RULE_KEY_Z		29
+#define RULE_KEY_0		39
+#define RULE_KEY_BACKSPACE	42
+
+#define RULE_MOD_SHIFT		0x22	// either shift
+#define RULE_MOD_ALTGR		0x40	// right alt, Polish letters
+
+// Letters and digits make up words, for the hodor and reverse modes
+#define RULE_IS_LETTER(key)	((key) >= RULE_KEY_A && (key) <= RULE_KEY_0)
+
+#define HODOR_SIZE 5
+#define HODOR_WORD RULE_KEY_H, RULE_KEY_O, RULE_KEY_D, RULE_KEY_O, RULE_KEY_R
+
+// Degramatyzer rules, the first one that matches a key is used.
+//
+// A rule matches when the key is `key`, the key before it was `prev`
+// (0: any) and, if `need_altgr` is set, AltGr is held.  The key is then
+// replaced by up to two keys.  With `erase` set the key before is taken
+// back with a backspace first, and the replacement is typed with that
+// key's modifiers instead of the current ones.  The first replacement
+// key keeps shift, the second never has it; `out_altgr` says what
+// happens to AltGr for each.
+#define RULE_ALTGR_KEEP		0
+#define RULE_ALTGR_SET		1
+#define RULE_ALTGR_CLEAR	2
+
+typedef struct {
+	uint8_t prev;
+	uint8_t key;
+	uint8_t need_altgr;
+	uint8_t erase;
+	uint8_t out[2];
+	uint8_t out_altgr[2];
+} DegramRule_t;
+
+#define DEGRAMATYZER_RULE_COUNT 8
+#define DEGRAMATYZER_RULES \
+	/* u na ó  */ DegramRule_t{ 0,          RULE_KEY_U, 0, 0, { RULE_KEY_O, 0 },          { RULE_ALTGR_SET,   0 } }, \
+	/* ó na u  */ DegramRule_t{ 0,          RULE_KEY_O, 1, 0, { RULE_KEY_U, 0 },          { RULE_ALTGR_CLEAR, 0 } }, \
+	/* rz na ż */ DegramRule_t{ RULE_KEY_R, RULE_KEY_Z, 0, 1, { RULE_KEY_Z, 0 },          { RULE_ALTGR_SET,   0 } }, \
+	/* ch na h */ DegramRule_t{ RULE_KEY_C, RULE_KEY_H, 0, 1, { RULE_KEY_H, 0 },          { RULE_ALTGR_KEEP,  0 } }, \
+	/* h na ch */ DegramRule_t{ 0,          RULE_KEY_H, 0, 0, { RULE_KEY_C, RULE_KEY_H }, { RULE_ALTGR_KEEP,  RULE_ALTGR_KEEP } }, \
+	/* ż na rz */ DegramRule_t{ 0,          RULE_KEY_Z, 1, 0, { RULE_KEY_R, RULE_KEY_Z }, { RULE_ALTGR_CLEAR, RULE_ALTGR_CLEAR } }, \
+	/* ą na om */ DegramRule_t{ 0,          RULE_KEY_A, 1, 0, { RULE_KEY_O, RULE_KEY_M }, { RULE_ALTGR_CLEAR, RULE_ALTGR_CLEAR } }, \
+	/* om na ą */ DegramRule_t{ RULE_KEY_O, RULE_KEY_M, 0, 1, { RULE_KEY_A, 0 },          { RULE_ALTGR_SET,   0 } }
+
+// Modifiers for replacement key `i` of a rule, from the modifiers the
+// rule works with (see `erase`)
+static inline uint8_t degram_rule_modifiers(const DegramRule_t *rule, uint8_t i, uint8_t modifiers)
+{
+	if (i > 0) modifiers &= ~RULE_MOD_SHIFT;
+	if (rule->out_altgr[i] == RULE_ALTGR_SET) modifiers |= RULE_MOD_ALTGR;
+	if (rule->out_altgr[i] == RULE_ALTGR_CLEAR) modifiers &= ~RULE_MOD_ALTGR;
+	return modifiers;
+}
+
+#endif
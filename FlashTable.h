@@ -0,0 +1,72 @@
+/*
+  FlashTable.h - read-only lookup tables kept in flash
+
+  A FlashTable<T, N> is built at compile time and, declared PROGMEM,
+  stays in flash on every board.  Reads go through the right instruction
+  for the architecture: pgm_read_* on AVR, where flash is a separate
+  address space, plain loads everywhere else.
+
+     const FlashTable<uint8_t, 3> table PROGMEM = { 1, 2, 3 };
+     uint8_t x = table[i];
+
+  Values are cast to T, so keep T the narrowest type that holds them.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef FlashTable_h
+#define FlashTable_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "int_pins.h"
+
+#if defined(__AVR__)
+static inline uint8_t flash_read(const uint8_t *p) { return pgm_read_byte(p); }
+static inline int8_t flash_read(const int8_t *p) { return pgm_read_byte(p); }
+static inline uint16_t flash_read(const uint16_t *p) { return pgm_read_word(p); }
+static inline int16_t flash_read(const int16_t *p) { return pgm_read_word(p); }
+
+template <typename T>
+static inline T flash_read(const T *p)
+{
+	T v;
+	memcpy_P(&v, p, sizeof(T));
+	return v;
+}
+#else
+template <typename T>
+static inline T flash_read(const T *p)
+{
+	return *p;
+}
+#endif
+
+template <typename T, size_t N>
+class FlashTable {
+  public:
+    template <typename... V>
+    constexpr FlashTable(V... values) : data{ static_cast<T>(values)... } {
+        static_assert(sizeof...(V) <= N, "too many values for the table");
+    }
+
+    T operator[](size_t i) const {
+        return flash_read(&data[i]);
+    }
+
+    static constexpr size_t size() {
+        return N;
+    }
+
+  private:
+    T data[N];
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+  HIDTyper.cpp - types key sequences with as few USB reports as possible
+
+  Keys are collected into a pending report.  The pending report is sent
+  when the next key can not join it: different modifiers, a key already
+  in it, or no free slot.  A key that is still held in the last sent
+  report would not register as a new press, so it either forces the
+  pending report out first or, with nothing pending, costs one empty
+  report to release it.  Keys held with hid_press() take the first
+  slots of every report and the typer's keys the ones left over.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include "HIDTyper.h"
+
+uint32_t hid_report_count = 0;
+
+static uint8_t sent_keys[HID_KEYS_PER_REPORT];
+static uint8_t sent_count;
+static uint8_t pending_keys[HID_KEYS_PER_REPORT];
+static uint8_t pending_count;
+static uint8_t pending_modifiers;
+static uint8_t held_keys[HID_HELD_KEYS];
+static uint8_t held_count;
+
+static bool contains(const uint8_t *keys, uint8_t count, uint8_t key)
+{
+	for (uint8_t i = 0; i < count; i++) {
+		if (keys[i] == key) return true;
+	}
+	return false;
+}
+
+static void send_report(const uint8_t *keys, uint8_t count, uint8_t modifiers)
+{
+	uint8_t k[6] = {0, 0, 0, 0, 0, 0};
+	uint8_t i;
+
+	for (i = 0; i < held_count; i++) k[i] = held_keys[i];
+	for (i = 0; i < count; i++) k[held_count + i] = keys[i];
+	Keyboard.set_modifier(modifiers);
+	Keyboard.set_key1(k[0]);
+	Keyboard.set_key2(k[1]);
+	Keyboard.set_key3(k[2]);
+	Keyboard.set_key4(k[3]);
+	Keyboard.set_key5(k[4]);
+	Keyboard.set_key6(k[5]);
+	Keyboard.send_now();
+	hid_report_count++;
+
+	for (i = 0; i < count; i++) sent_keys[i] = keys[i];
+	sent_count = count;
+}
+
+static void flush(void)
+{
+	if (pending_count) {
+		send_report(pending_keys, pending_count, pending_modifiers);
+		pending_count = 0;
+	}
+}
+
+void hid_begin(void)
+{
+	// the caller starts from a report with no keys down
+	sent_count = 0;
+	pending_count = 0;
+}
+
+void hid_key(uint16_t key, uint8_t modifiers)
+{
+	uint8_t k = key & 0xFF;
+
+	if (!k || contains(held_keys, held_count, k)) return;
+	if (pending_count && (modifiers != pending_modifiers ||
+	                      pending_count >= HID_KEYS_PER_REPORT ||
+	                      pending_count + held_count >= 6 ||
+	                      contains(pending_keys, pending_count, k) ||
+	                      contains(sent_keys, sent_count, k))) {
+		flush();
+	}
+	if (!pending_count && contains(sent_keys, sent_count, k)) {
+		send_report(NULL, 0, modifiers);
+	}
+	pending_modifiers = modifiers;
+	pending_keys[pending_count++] = k;
+}
+
+void hid_end(uint8_t modifiers)
+{
+	flush();
+	send_report(NULL, 0, modifiers);
+}
+
+void hid_press(uint16_t key)
+{
+	uint8_t k = key & 0xFF;
+
+	// typematic repeats press it again
+	if (contains(held_keys, held_count, k)) return;
+	Keyboard.press(key);
+	if (held_count < HID_HELD_KEYS) held_keys[held_count++] = k;
+}
+
+void hid_release(uint16_t key)
+{
+	uint8_t k = key & 0xFF;
+	uint8_t i;
+
+	Keyboard.release(key);
+	for (i = 0; i < held_count; i++) {
+		if (held_keys[i] == k) break;
+	}
+	if (i == held_count) return;
+	held_count--;
+	for (; i < held_count; i++) held_keys[i] = held_keys[i + 1];
+}
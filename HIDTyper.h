@@ -0,0 +1,59 @@
+/*
+  HIDTyper.h - types key sequences with as few USB reports as possible
+
+  Every report costs one USB frame (1 ms), so the typer:
+   - sends the modifier state together with the keys instead of in
+     separate modifier-only reports, and keeps it held across keys that
+     need the same state,
+   - puts consecutive distinct keys with the same modifiers into one
+     report, up to HID_KEYS_PER_REPORT of them,
+   - only sends an empty report when a key has to be pressed again.
+
+  Keys held down outside the typer (the remapped navigation keys) go
+  through hid_press() and hid_release(), so that the typer's reports
+  keep them in their slots instead of releasing them.
+
+  Usage:
+     hid_begin();
+     hid_key(KEY_H, modifiers);
+     hid_key(KEY_I, modifiers);
+     hid_end(modifiers);      // releases all keys, leaves modifiers set
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef HIDTyper_h
+#define HIDTyper_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+// Keys that arrive in one report are pressed in whatever order the host
+// chooses; the HID spec does not fix it.  Linux's HID driver goes by
+// array order.  For a host that scrambles the text, build with
+// -DHID_KEYS_PER_REPORT=1, one key per report.
+#ifndef HID_KEYS_PER_REPORT
+#define HID_KEYS_PER_REPORT 6
+#endif
+
+// Keys held with hid_press() at the same time; each takes a report slot
+#define HID_HELD_KEYS 3
+
+// Number of reports sent since power up
+extern uint32_t hid_report_count;
+
+void hid_begin(void);
+void hid_key(uint16_t key, uint8_t modifiers);
+void hid_end(uint8_t modifiers);
+
+// Keyboard.press() and Keyboard.release(), for keys held across typing
+void hid_press(uint16_t key);
+void hid_release(uint16_t key);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+  PS2Control.cpp - raw HID control and telemetry endpoint
+
+  Runs on its own interface next to the keyboard.  Sends use a zero
+  timeout: if the host is not reading, telemetry is dropped rather than
+  holding up the keyboard.  The load test is the exception, it holds up
+  everything while it runs and waits for its results to be taken.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include "PS2Control.h"
+
+#ifdef RAWHID_INTERFACE
+
+#include "ControlProtocol.h"
+#include "PS2LoadGen.h"
+
+#if REPORT_HISTOGRAM_SIZE != CTRL_STAT_HISTOGRAM_SIZE
+#error "stats histogram does not match the control protocol"
+#endif
+
+// How long a load result may wait for the host to read it
+#define LOAD_SEND_TIMEOUT_MS 100
+
+static uint8_t packet[CTRL_PACKET_SIZE];
+static uint16_t stream_ms = 0;
+static uint32_t last_stream = 0;
+
+static void send_stats(void)
+{
+	PS2Stats_t stats;
+
+	PS2Keyboard::getStats(&stats);
+	memset(packet, 0, sizeof(packet));
+	packet[0] = CTRL_GET_STATS;
+	ctrl_put32(packet, CTRL_STAT_INTERRUPTS, stats.interrupts);
+	ctrl_put32(packet, CTRL_STAT_FRAMES, stats.frames);
+	ctrl_put32(packet, CTRL_STAT_FRAME_ERRORS, stats.frame_errors);
+	ctrl_put32(packet, CTRL_STAT_RING_DROPS, stats.ring_drops);
+	ctrl_put32(packet, CTRL_STAT_INHIBITS, stats.inhibits);
+	ctrl_put32(packet, CTRL_STAT_KEYSTROKES, stats.keystrokes);
+	ctrl_put32(packet, CTRL_STAT_REPORTS, stats.reports);
+	for (uint8_t i = 0; i < CTRL_STAT_HISTOGRAM_SIZE; i++) {
+		ctrl_put32(packet, CTRL_STAT_HISTOGRAM + i, stats.reports_per_key[i]);
+	}
+	RawHID.send(packet, 0);
+}
+
+// Every mode in turn, then back to the mode it started in
+static void load_test(void)
+{
+	PS2LoadConfig_t config;
+	PS2LoadResult_t result;
+	uint8_t mode = PS2Keyboard::getMode();
+
+	config.pattern = packet[1];
+	config.flags = packet[2];
+	config.rate = ctrl_get32(packet, CTRL_LOAD_RATE);
+	config.duration_ms = ctrl_get32(packet, CTRL_LOAD_DURATION);
+	config.seed = ctrl_get32(packet, CTRL_LOAD_SEED);
+	for (uint8_t m = 0; m < PS2Keyboard::modeCount(); m++) {
+		ps2_load_test(&config, m, &result);
+		memset(packet, 0, sizeof(packet));
+		packet[0] = CTRL_LOAD_TEST;
+		packet[1] = m;
+		packet[2] = PS2Keyboard::modeCount();
+		ctrl_put32(packet, CTRL_LOAD_SCAN_CODES, result.scan_codes);
+		ctrl_put32(packet, CTRL_LOAD_KEYS, result.keys);
+		ctrl_put32(packet, CTRL_LOAD_ELAPSED_US, result.elapsed_us);
+		ctrl_put32(packet, CTRL_LOAD_RING_DROPS, result.ring_drops);
+		ctrl_put32(packet, CTRL_LOAD_INHIBITS, result.inhibits);
+		ctrl_put32(packet, CTRL_LOAD_REPORTS, result.reports);
+		ctrl_put32(packet, CTRL_LOAD_P50_US, result.latency_p50_us);
+		ctrl_put32(packet, CTRL_LOAD_P90_US, result.latency_p90_us);
+		ctrl_put32(packet, CTRL_LOAD_P99_US, result.latency_p99_us);
+		ctrl_put32(packet, CTRL_LOAD_MAX_US, result.latency_max_us);
+		RawHID.send(packet, LOAD_SEND_TIMEOUT_MS);
+	}
+	PS2Keyboard::setMode(mode);
+}
+
+static void reply(uint8_t cmd)
+{
+	memset(packet, 0, sizeof(packet));
+	packet[0] = cmd;
+	if (cmd == CTRL_GET_MODE || cmd == CTRL_SET_MODE) {
+		packet[1] = PS2Keyboard::getMode();
+		packet[2] = PS2Keyboard::modeCount();
+	}
+	RawHID.send(packet, 0);
+}
+
+static void handle(void)
+{
+	switch (packet[0]) {
+	case CTRL_GET_MODE:
+		reply(CTRL_GET_MODE);
+		break;
+	case CTRL_SET_MODE:
+		if (packet[1] >= PS2Keyboard::modeCount()) {
+			reply(CTRL_ERROR);
+			break;
+		}
+		PS2Keyboard::setMode(packet[1]);
+		reply(CTRL_SET_MODE);
+		break;
+	case CTRL_GET_STATS:
+		send_stats();
+		break;
+	case CTRL_STREAM:
+		stream_ms = packet[1] | (packet[2] << 8);
+		last_stream = millis();
+		reply(CTRL_STREAM);
+		break;
+	case CTRL_SET_TABLE:
+		if (packet[3] > CTRL_TABLE_CHUNK ||
+		    !PS2Keyboard::setTable(packet[1], packet[2], packet + 4, packet[3])) {
+			reply(CTRL_ERROR);
+			break;
+		}
+		reply(CTRL_SET_TABLE);
+		break;
+	case CTRL_RESET_TABLE:
+		reply(PS2Keyboard::resetTable(packet[1]) ? CTRL_RESET_TABLE : CTRL_ERROR);
+		break;
+	case CTRL_LOAD_TEST:
+		if (packet[1] >= LOAD_PATTERNS) {
+			reply(CTRL_ERROR);
+			break;
+		}
+		load_test();
+		break;
+	default:
+		reply(CTRL_ERROR);
+		break;
+	}
+}
+
+void control_poll(void)
+{
+	if (RawHID.recv(packet, 0) > 0) {
+		handle();
+	}
+	if (stream_ms && millis() - last_stream >= stream_ms) {
+		last_stream = millis();
+		send_stats();
+	}
+}
+
+#endif
@@ -0,0 +1,29 @@
+/*
+  PS2Control.h - raw HID control and telemetry endpoint
+
+  Only built when the USB type includes raw HID (Teensyduino defines
+  RAWHID_INTERFACE then).  The protocol is in ControlProtocol.h, the
+  host side is extras/degramctl.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef PS2Control_h
+#define PS2Control_h
+
+#include "PS2Keyboard_2.h"
+
+#ifdef RAWHID_INTERFACE
+
+/**
+ * Answers pending requests and sends due telemetry.  Never waits on the
+ * host, call it from loop().
+ */
+void control_poll(void);
+
+#endif
+
+#endif
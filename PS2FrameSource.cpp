@@ -0,0 +1,353 @@
+/*
+  PS2FrameSource.cpp - frame sources for the PS2Keyboard library
+
+  Edge:  the original receiver, an interrupt on every falling clock edge
+         samples the data line.  11 interrupts per byte.
+  SPI:   Teensy 3.x SPI0 as a slave, with the keyboard clock on SCK.  The
+         peripheral shifts in the whole 11 bit frame and interrupts once.
+  Sim:   no hardware at all, scan codes are pushed by software.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include "PS2FrameSource.h"
+
+uint16_t ps2_make_frame(uint8_t scan_code)
+{
+    uint8_t p = scan_code;
+
+    p ^= p >> 4;
+    p ^= p >> 2;
+    p ^= p >> 1;
+    // odd parity: parity bit set when the data has an even number of ones
+    return ((uint16_t)scan_code << 1) | ((uint16_t)(~p & 1) << 9) | 0x400;
+}
+
+bool ps2_frame_valid(uint16_t frame)
+{
+    uint16_t p = (frame >> 1) & 0x1FF;  // data and parity, odd weight
+
+    p ^= p >> 8;
+    p ^= p >> 4;
+    p ^= p >> 2;
+    p ^= p >> 1;
+    return !(frame & 0x001) && (frame & 0x400) && (p & 1);
+}
+
+uint8_t ps2_irq_number(uint8_t irq_pin)
+{
+  uint8_t irq_num=255;
+
+#ifdef CORE_INT_EVERY_PIN
+  irq_num = irq_pin;
+
+#else
+  switch(irq_pin) {
+    #ifdef CORE_INT0_PIN
+    case CORE_INT0_PIN:
+      irq_num = 0;
+      break;
+    #endif
+    #ifdef CORE_INT1_PIN
+    case CORE_INT1_PIN:
+      irq_num = 1;
+      break;
+    #endif
+    #ifdef CORE_INT2_PIN
+    case CORE_INT2_PIN:
+      irq_num = 2;
+      break;
+    #endif
+    #ifdef CORE_INT3_PIN
+    case CORE_INT3_PIN:
+      irq_num = 3;
+      break;
+    #endif
+    #ifdef CORE_INT4_PIN
+    case CORE_INT4_PIN:
+      irq_num = 4;
+      break;
+    #endif
+    #ifdef CORE_INT5_PIN
+    case CORE_INT5_PIN:
+      irq_num = 5;
+      break;
+    #endif
+    #ifdef CORE_INT6_PIN
+    case CORE_INT6_PIN:
+      irq_num = 6;
+      break;
+    #endif
+    #ifdef CORE_INT7_PIN
+    case CORE_INT7_PIN:
+      irq_num = 7;
+      break;
+    #endif
+  }
+#endif
+  return irq_num;
+}
+
+
+// Edge source
+
+static uint8_t DataPin;
+static uint8_t IrqPin;
+static volatile uint8_t inhibited=0;
+static volatile uint8_t bitcount=0;
+static volatile uint16_t incoming=0;
+
+static void ps2_edge_interrupt(void)
+{
+    static uint32_t prev_ms=0;
+    uint32_t now_ms;
+    uint8_t val;
+
+    ps2_irq_count++;
+    if (inhibited) return;  // our own falling edge
+    val = digitalRead(DataPin);
+    now_ms = millis();
+    if (now_ms - prev_ms > 250) {
+        bitcount = 0;
+        incoming = 0;
+    }
+    prev_ms = now_ms;
+    incoming |= (uint16_t)val << bitcount;
+    bitcount++;
+    if (bitcount == PS2_FRAME_BITS) {
+        ps2_frame_received(incoming);
+        bitcount = 0;
+        incoming = 0;
+    }
+}
+
+static uint8_t edge_irq_num=255;
+
+static void ps2_edge_begin(uint8_t data_pin, uint8_t irq_pin)
+{
+  uint8_t irq_num;
+
+  DataPin = data_pin;
+  IrqPin = irq_pin;
+
+  // initialize the pins
+#ifdef INPUT_PULLUP
+  pinMode(irq_pin, INPUT_PULLUP);
+  pinMode(data_pin, INPUT_PULLUP);
+#else
+  pinMode(irq_pin, INPUT);
+  digitalWrite(irq_pin, HIGH);
+  pinMode(data_pin, INPUT);
+  digitalWrite(data_pin, HIGH);
+#endif
+
+  irq_num = ps2_irq_number(irq_pin);
+  edge_irq_num = irq_num;
+  if (irq_num < 255) {
+    attachInterrupt(irq_num, ps2_edge_interrupt, FALLING);
+  }
+}
+
+// Never drive the clock high, the keyboard's open collector would fight
+// it.  Low, or input with the pullup.  On Teensy 3 pinMode() rewrites
+// the whole pin control register, interrupt config included, so the
+// interrupt is attached again once the pin is an input, as
+// spi_watch_clock() does.
+static void ps2_edge_inhibit(bool on)
+{
+    if (on) {
+        inhibited = 1;
+        digitalWrite(IrqPin, LOW);
+        pinMode(IrqPin, OUTPUT);
+    } else {
+#ifdef INPUT_PULLUP
+        pinMode(IrqPin, INPUT_PULLUP);
+#else
+        pinMode(IrqPin, INPUT);
+        digitalWrite(IrqPin, HIGH);
+#endif
+        if (edge_irq_num < 255) {
+            attachInterrupt(edge_irq_num, ps2_edge_interrupt, FALLING);
+        }
+        // a frame cut short by the inhibit is sent again from the start
+        bitcount = 0;
+        incoming = 0;
+        inhibited = 0;
+    }
+}
+
+const PS2FrameSource_t PS2FrameSource_Edge = {
+    ps2_edge_begin,
+    NULL,
+    ps2_edge_inhibit
+};
+
+
+// SPI source
+//
+// In slave mode the DSPI shifts MSB first, so the first bit on the wire
+// ends up in bit 10 of the received word.  There is no way to resync the
+// slave's bit counter except by negating CS, so after a bad frame CS is
+// held high and SCK handed to the GPIO, where an interrupt timestamps
+// every falling edge.  The SPI gets the pin back once no edge has come
+// for SPI_QUIET_US; clock edges within a frame are at most 100us apart,
+// so the next edge is the start of a frame.
+
+#if defined(CORE_PS2_SPI_SLAVE) && PS2_FRAME_SOURCE == PS2_FRAME_SOURCE_SPI
+
+#define SPI_QUIET_US 2000
+#define SPI_SCK_MUX  (PORT_PCR_MUX(2) | PORT_PCR_PE | PORT_PCR_PS)
+
+static volatile uint8_t spi_resync = 0;
+static volatile uint32_t spi_resync_us;
+
+static void spi_clock_edge(void)
+{
+    spi_resync_us = micros();
+}
+
+// SCK as a GPIO with its edges watched, while resyncing
+static void spi_watch_clock(void)
+{
+    pinMode(PS2_SPI_SCK_PIN, INPUT_PULLUP);
+    spi_resync_us = micros();
+    attachInterrupt(ps2_irq_number(PS2_SPI_SCK_PIN), spi_clock_edge, FALLING);
+}
+
+static void spi_attach_clock(void)
+{
+    detachInterrupt(ps2_irq_number(PS2_SPI_SCK_PIN));
+    PS2_SPI_SCK_CONFIG = SPI_SCK_MUX;
+}
+
+static inline uint16_t reverse_frame(uint16_t w)
+{
+    uint16_t r = 0;
+    uint8_t i;
+
+    for (i = 0; i < PS2_FRAME_BITS; i++) {
+        r = (r << 1) | (w & 1);
+        w >>= 1;
+    }
+    return r;
+}
+
+void spi0_isr(void)
+{
+    uint16_t frame;
+
+    ps2_irq_count++;
+    while (SPI0_SR & SPI_SR_RXCTR) {
+        frame = reverse_frame(SPI0_POPR);
+        if ((frame & 0x001) || !(frame & 0x400)) {
+            // misaligned, count it and drop the slave off the bus
+            ps2_frame_count++;
+            ps2_frame_errors++;
+            digitalWriteFast(PS2_SPI_CS_PIN, HIGH);
+            spi_resync = 1;
+            spi_watch_clock();
+            SPI0_MCR |= SPI_MCR_CLR_RXF;
+            break;
+        }
+        ps2_frame_received(frame);
+    }
+    SPI0_SR = SPI_SR_RFDF | SPI_SR_RFOF | SPI_SR_TFUF;
+}
+
+static void ps2_spi_begin(uint8_t data_pin, uint8_t irq_pin)
+{
+    // data_pin and irq_pin are fixed by the SPI0 pin mux
+    (void)data_pin;
+    (void)irq_pin;
+
+    pinMode(PS2_SPI_CS_PIN, OUTPUT);
+    digitalWriteFast(PS2_SPI_CS_PIN, LOW);
+
+    SIM_SCGC6 |= SIM_SCGC6_SPI0;
+    PS2_SPI_SCK_CONFIG = SPI_SCK_MUX;                                // SCK
+    CORE_PIN12_CONFIG = PORT_PCR_MUX(2) | PORT_PCR_PE | PORT_PCR_PS; // SIN
+    CORE_PIN10_CONFIG = PORT_PCR_MUX(2);                             // PCS0
+
+    SPI0_MCR = SPI_MCR_HALT | SPI_MCR_CLR_RXF | SPI_MCR_CLR_TXF;
+    // clock idles high and data is valid on the falling edge
+    SPI0_CTAR0_SLAVE = SPI_CTAR_FMSZ(PS2_FRAME_BITS - 1) | SPI_CTAR_CPOL;
+    SPI0_RSER = SPI_RSER_RFDF_RE;
+    SPI0_SR = SPI_SR_RFDF | SPI_SR_RFOF | SPI_SR_TFUF;
+    SPI0_MCR = 0;
+    NVIC_ENABLE_IRQ(IRQ_SPI0);
+}
+
+static volatile uint8_t spi_inhibited = 0;
+
+static void ps2_spi_poll(void)
+{
+    if (!spi_resync || spi_inhibited) return;
+    noInterrupts();
+    if (micros() - spi_resync_us > SPI_QUIET_US) {
+        spi_resync = 0;
+        spi_attach_clock();
+        SPI0_MCR |= SPI_MCR_CLR_RXF;
+        digitalWriteFast(PS2_SPI_CS_PIN, LOW);
+    }
+    interrupts();
+}
+
+// The clock is taken away from the SPI and driven low as a GPIO.  CS
+// stays high meanwhile so a partly received frame is thrown away.
+static void ps2_spi_inhibit(bool on)
+{
+    if (on) {
+        spi_inhibited = 1;
+        digitalWriteFast(PS2_SPI_CS_PIN, HIGH);
+        if (spi_resync) detachInterrupt(ps2_irq_number(PS2_SPI_SCK_PIN));
+        digitalWriteFast(PS2_SPI_SCK_PIN, LOW);
+        pinMode(PS2_SPI_SCK_PIN, OUTPUT);
+    } else {
+        SPI0_MCR |= SPI_MCR_CLR_RXF;
+        spi_inhibited = 0;
+        if (spi_resync) {
+            // the keyboard may resend mid-frame, wait for quiet again
+            spi_watch_clock();
+        } else {
+            PS2_SPI_SCK_CONFIG = SPI_SCK_MUX;
+            digitalWriteFast(PS2_SPI_CS_PIN, LOW);
+        }
+    }
+}
+
+const PS2FrameSource_t PS2FrameSource_SPI = {
+    ps2_spi_begin,
+    ps2_spi_poll,
+    ps2_spi_inhibit
+};
+
+#endif
+
+
+// Simulated source
+
+static void ps2_sim_begin(uint8_t data_pin, uint8_t irq_pin)
+{
+    (void)data_pin;
+    (void)irq_pin;
+}
+
+static void ps2_sim_inhibit(bool on)
+{
+    (void)on;
+}
+
+void ps2_sim_scan_code(uint8_t scan_code)
+{
+    ps2_irq_count++;
+    ps2_frame_received(ps2_make_frame(scan_code));
+}
+
+const PS2FrameSource_t PS2FrameSource_Sim = {
+    ps2_sim_begin,
+    NULL,
+    ps2_sim_inhibit
+};
@@ -0,0 +1,71 @@
+/*
+  PS2FrameSource.h - receive side of the PS2Keyboard library
+
+  A frame source turns the keyboard clock and data lines into complete
+  11-bit PS/2 frames and hands them to ps2_frame_received(), which checks
+  them and queues the scan code.  Which source is built is chosen with
+  PS2_FRAME_SOURCE, a compiler flag for the whole build (see int_pins.h).
+
+  Frame layout used everywhere: bit 0 is the first bit on the wire.
+     bit 0     start, always 0
+     bit 1..8  data, LSB first
+     bit 9     odd parity
+     bit 10    stop, always 1
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef PS2FrameSource_h
+#define PS2FrameSource_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "int_pins.h"
+
+#define PS2_FRAME_BITS 11
+
+typedef struct {
+	void (*begin)(uint8_t data_pin, uint8_t irq_pin);
+	void (*poll)(void);	// called from the main loop, may be NULL
+	void (*inhibit)(bool on);	// hold the clock line low, or let it go
+} PS2FrameSource_t;
+
+extern const PS2FrameSource_t PS2FrameSource_Edge;
+#if defined(CORE_PS2_SPI_SLAVE) && PS2_FRAME_SOURCE == PS2_FRAME_SOURCE_SPI
+extern const PS2FrameSource_t PS2FrameSource_SPI;
+#endif
+extern const PS2FrameSource_t PS2FrameSource_Sim;
+
+// Counters kept by the receive path, see PS2Keyboard::getStats()
+extern volatile uint32_t ps2_irq_count;
+extern volatile uint32_t ps2_frame_count;
+extern volatile uint32_t ps2_frame_errors;
+extern volatile uint32_t ps2_ring_drops;
+extern volatile uint32_t ps2_inhibit_count;
+
+// Set while the ring is over its high mark and the keyboard held off
+extern volatile uint8_t ps2_inhibited;
+
+// Called by a frame source, from interrupt context, for every frame
+void ps2_frame_received(uint16_t frame);
+
+// Builds a valid frame around a scan code
+uint16_t ps2_make_frame(uint8_t scan_code);
+
+// Start, stop and parity check
+bool ps2_frame_valid(uint16_t frame);
+
+// attachInterrupt() number for a pin, 255 if it has none
+uint8_t ps2_irq_number(uint8_t irq_pin);
+
+// Simulated source only: push one scan code as if it came off the wire
+void ps2_sim_scan_code(uint8_t scan_code);
+
+#endif
@@ -49,6 +49,11 @@
 */
 
 #include "PS2Keyboard_2.h"
+#include "PS2FrameSource.h"
+#include "HIDTyper.h"
+#include "ControlProtocol.h"
+#include "FlashTable.h"
+#include "DegramatyzerRules.h"
 
 #define MODIFIERKEY_CTRL ( 0x01 | 0x8000 )
 #define MODIFIERKEY_SHIFT ( 0x02 | 0x8000 )
@@ -74,41 +79,66 @@
 #define BUFFER_SIZE 45
 static volatile uint8_t buffer[BUFFER_SIZE];
 static volatile uint8_t head, tail;
-static uint8_t DataPin;
+
+// Flow control: with this many scan codes waiting the keyboard is told
+// to hold off (clock low), and it is let go again once get_scan_code()
+// has drained the buffer below RING_LOW_MARK.  The keyboard keeps the
+// keys in its own buffer meanwhile.  Leave room above the high mark for
+// a frame already on the wire.
+#define RING_HIGH_MARK 36
+#define RING_LOW_MARK  8
+volatile uint8_t ps2_inhibited = 0;
+static volatile uint32_t inhibit_us;
 static uint8_t CharBuffer=0;
 static uint8_t UTF8next=0;
 static const PS2Keymap_t *keymap=NULL;
 
-// The ISR for the external interrupt
-void ps2interrupt(void)
+#if PS2_FRAME_SOURCE == PS2_FRAME_SOURCE_SPI
+static const PS2FrameSource_t *source = &PS2FrameSource_SPI;
+#elif PS2_FRAME_SOURCE == PS2_FRAME_SOURCE_SIM
+static const PS2FrameSource_t *source = &PS2FrameSource_Sim;
+#else
+static const PS2FrameSource_t *source = &PS2FrameSource_Edge;
+#endif
+
+volatile uint32_t ps2_irq_count = 0;
+volatile uint32_t ps2_frame_count = 0;
+volatile uint32_t ps2_frame_errors = 0;
+volatile uint32_t ps2_ring_drops = 0;
+volatile uint32_t ps2_inhibit_count = 0;
+static uint32_t key_count = 0;
+static uint32_t report_histogram[REPORT_HISTOGRAM_SIZE];
+
+static inline uint8_t ring_count(void)
+{
+    uint8_t h = head, t = tail;
+
+    return h >= t ? h - t : BUFFER_SIZE + h - t;
+}
+
+// Called from the frame source's interrupt for every 11 bit frame
+void ps2_frame_received(uint16_t frame)
 {
-    static uint8_t bitcount=0;
-    static uint8_t incoming=0;
-    static uint32_t prev_ms=0;
-    uint32_t now_ms;
-    uint8_t n, val;
-
-    val = digitalRead(DataPin);
-    now_ms = millis();
-    if (now_ms - prev_ms > 250) {
-        bitcount = 0;
-        incoming = 0;
+    uint8_t i;
+
+    ps2_frame_count++;
+    if (!ps2_frame_valid(frame)) {
+        ps2_frame_errors++;
+        return;
     }
-    prev_ms = now_ms;
-    n = bitcount - 1;
-    if (n <= 7) {
-        incoming |= (val << n);
+    i = head + 1;
+    if (i >= BUFFER_SIZE) i = 0;
+    if (i != tail) {
+        buffer[i] = (uint8_t)(frame >> 1);
+        head = i;
+    } else {
+        ps2_ring_drops++;
     }
-    bitcount++;
-    if (bitcount == 11) {
-        uint8_t i = head + 1;
-        if (i >= BUFFER_SIZE) i = 0;
-        if (i != tail) {
-            buffer[i] = incoming;
-            head = i;
-        }
-        bitcount = 0;
-        incoming = 0;
+    if (!ps2_inhibited && ring_count() >= RING_HIGH_MARK) {
+        ps2_inhibited = 1;
+        ps2_inhibit_count++;
+        inhibit_us = micros();
+        source->inhibit(true);
     }
 }
 
@@ -116,6 +146,17 @@ static inline uint8_t get_scan_code(void)
 {
     uint8_t c, i;
 
+    if (source->poll) source->poll();
+    // the clock has to stay low at least 100us to count as an inhibit;
+    // checked before the empty test, a ring drained within those 100us
+    // would otherwise keep the keyboard held off for good
+    if (ps2_inhibited && ring_count() <= RING_LOW_MARK &&
+        micros() - inhibit_us >= 100) {
+        noInterrupts();
+        source->inhibit(false);
+        ps2_inhibited = 0;
+        interrupts();
+    }
     i = tail;
     if (i == head) return 0;
     i++;
@@ -132,8 +173,13 @@ static inline uint8_t get_scan_code(void)
 // output.  If a non-US keyboard is used, these may need to be modified
 // for the desired output.
 //
+// Tables keep only the low byte of the USB key codes, which is all the
+// report carries; KEY_FLAGS puts back the high byte the KEY_ constants
+// have on Teensy, so the modes can keep comparing against them.
+
+#define KEY_FLAGS   (KEY_A & ~0xFF)
 
-const int ps2_to_usb_map[PS2_KEYMAP_SIZE] = 
+const FlashTable<uint8_t, PS2_KEYMAP_SIZE> ps2_to_usb_map PROGMEM = 
    {0, KEY_F9, 0, KEY_F5, KEY_F3, KEY_F1, KEY_F2, KEY_F12,
     0, KEY_F10, KEY_F8, KEY_F6, KEY_F4, KEY_TAB, KEY_TILDE, 0,
     0, 0 /*LALT*/, 0 /*LSHIFT*/, 0, 0 /*LCTRL*/, KEY_Q, KEY_1, 0,
@@ -173,7 +219,8 @@ void hodorifier(int c, uint8_t modifiers);
 void reverser(int c, uint8_t modifiers);
 void touretter(int c, uint8_t modifiers);
 
-void (*modes[NUM_MODES])(int, uint8_t) = {
+typedef void (*mode_fn_t)(int, uint8_t);
+const FlashTable<mode_fn_t, NUM_MODES> modes PROGMEM = {
 /*modes[NO_MODE]      = */no_mode,
 /*modes[DEGRAMATYZER] = */degramatyzer,
 /*modes[HODOR]        = */hodorifier,
@@ -181,210 +228,262 @@ void (*modes[NUM_MODES])(int, uint8_t) = {
 /*modes[TOURETTE]     = */touretter
 };
 
+// What each mode remembers between keys.  Only one mode runs at a time,
+// so they all live in one arena the size of the largest; set_mode()
+// starts the new mode afresh by resetting its counters, whatever the
+// last mode left in the arena.
+#define LETTER_BUFFER_SIZE 32
+
+typedef struct {
+	uint16_t prev_c;
+	uint8_t  prev_modifiers;
+} DegramatyzerState_t;
+
+typedef struct {
+	int8_t letter_counter;
+} HodorState_t;
+
+typedef struct {
+	int8_t   letter_counter;
+	uint16_t letter_buffer[LETTER_BUFFER_SIZE];
+	uint8_t  modifiers_buffer[LETTER_BUFFER_SIZE];
+} ReverseState_t;
+
+static union {
+	DegramatyzerState_t degramatyzer;
+	HodorState_t        hodor;
+	ReverseState_t      reverse;
+} mode_state;
+
+static void no_reset(void)
+{
+}
+
+static void degramatyzer_reset(void)
+{
+	mode_state.degramatyzer.prev_c = 0;
+	mode_state.degramatyzer.prev_modifiers = 0;
+}
+
+static void hodorifier_reset(void)
+{
+	mode_state.hodor.letter_counter = 0;
+}
+
+static void reverser_reset(void)
+{
+	mode_state.reverse.letter_counter = 0;
+}
+
+typedef void (*mode_reset_fn_t)(void);
+const FlashTable<mode_reset_fn_t, NUM_MODES> mode_resets PROGMEM = {
+/*mode_resets[NO_MODE]      = */no_reset,
+/*mode_resets[DEGRAMATYZER] = */degramatyzer_reset,
+/*mode_resets[HODOR]        = */hodorifier_reset,
+/*mode_resets[REVERSE]      = */reverser_reset,
+/*mode_resets[TOURETTE]     = */no_reset
+};
+
 
 void no_mode(int c, uint8_t modifiers)
 {
-	Keyboard.set_key1(c);
-	Keyboard.send_now();
+	hid_begin();
+	hid_key(c, modifiers);
+	hid_end(modifiers);
 }
 
-static int     prev_c         = 0;
-static uint8_t prev_modifiers = 0;
+const FlashTable<DegramRule_t, DEGRAMATYZER_RULE_COUNT> degramatyzer_rules PROGMEM = {
+	DEGRAMATYZER_RULES
+};
+
 void degramatyzer(int c, uint8_t modifiers)
 {
-	if(c == KEY_U) { //u na ó
-		Keyboard.set_modifier(modifiers | MODIFIERKEY_RIGHT_ALT);
-		Keyboard.set_key1(KEY_O);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers);
-		Keyboard.send_now();
-	} else if(c == KEY_O && (modifiers & MODIFIERKEY_RIGHT_ALT)) { //u na ó
-		Keyboard.set_modifier(modifiers & ~MODIFIERKEY_RIGHT_ALT);
-		Keyboard.set_key1(KEY_U);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers);
-		Keyboard.send_now();
-	} else if(prev_c == KEY_R && c == KEY_Z) { //rz na ż
-		Keyboard.set_modifier(0);
-		Keyboard.set_key1(KEY_BACKSPACE);
-		Keyboard.send_now();
-		Keyboard.set_modifier(prev_modifiers & (MODIFIERKEY_LEFT_SHIFT | MODIFIERKEY_RIGHT_SHIFT) | MODIFIERKEY_RIGHT_ALT);
-		Keyboard.set_key1(KEY_Z);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers);
-		Keyboard.send_now();
-	} else if(prev_c == KEY_C && c == KEY_H) { //ch na h
-		Keyboard.set_modifier(0);
-		Keyboard.set_key1(KEY_BACKSPACE);
-		Keyboard.send_now();
-		Keyboard.set_modifier(prev_modifiers);
-		Keyboard.set_key1(KEY_H);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers);
-		Keyboard.send_now();
-	} else if(prev_c != KEY_C && c == KEY_H) {// h na ch
-		Keyboard.set_modifier(modifiers);
-		Keyboard.set_key1(KEY_C);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers & ~MODIFIERKEY_RIGHT_SHIFT & ~MODIFIERKEY_LEFT_SHIFT);
-		Keyboard.set_key1(KEY_H);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers);
-		Keyboard.send_now();
-	} else if(c == KEY_Z && (modifiers & MODIFIERKEY_RIGHT_ALT)) { //ż na rz
-		Keyboard.set_modifier(modifiers & ~MODIFIERKEY_RIGHT_ALT);
-		Keyboard.set_key1(KEY_R);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers & ~MODIFIERKEY_RIGHT_ALT & ~MODIFIERKEY_RIGHT_SHIFT & ~MODIFIERKEY_LEFT_SHIFT);
-		Keyboard.set_key1(KEY_Z);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers);
-		Keyboard.send_now();
-	} else if(c == KEY_A && (modifiers & MODIFIERKEY_RIGHT_ALT)) { // ą na om
-		Keyboard.set_modifier(modifiers & ~MODIFIERKEY_RIGHT_ALT);
-		Keyboard.set_key1(KEY_O);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers & ~MODIFIERKEY_RIGHT_ALT & ~MODIFIERKEY_RIGHT_SHIFT & ~MODIFIERKEY_LEFT_SHIFT);
-		Keyboard.set_key1(KEY_M);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers);
-		Keyboard.send_now();
-	} else if(prev_c == KEY_O && c == KEY_M) { //om na ą
-		Keyboard.set_modifier(0);
-		Keyboard.set_key1(KEY_BACKSPACE);
-		Keyboard.send_now();
-		Keyboard.set_modifier(prev_modifiers | MODIFIERKEY_RIGHT_ALT);
-		Keyboard.set_key1(KEY_A);
-		Keyboard.send_now();
-		Keyboard.set_modifier(modifiers);
-		Keyboard.send_now();
-	} else {
-		Keyboard.set_key1(c);
-		Keyboard.send_now();
+	DegramatyzerState_t *state = &mode_state.degramatyzer;
+	uint8_t key = c & 0xFF;
+	uint8_t prev_key = state->prev_c & 0xFF;
+	uint8_t i;
+
+	hid_begin();
+	for(i = 0; i < DEGRAMATYZER_RULE_COUNT; i++) {
+		DegramRule_t rule = degramatyzer_rules[i];
+		
+		if(rule.key != key || (rule.prev && rule.prev != prev_key) ||
+		   (rule.need_altgr && !(modifiers & RULE_MOD_ALTGR)))
+			continue;
+		
+		uint8_t base = modifiers;
+		if(rule.erase) {
+			hid_key(KEY_BACKSPACE, 0);
+			base = state->prev_modifiers;
+		}
+		for(uint8_t j = 0; j < 2 && rule.out[j]; j++) {
+			hid_key(rule.out[j], degram_rule_modifiers(&rule, j, base));
+		}
+		break;
+	}
+	if(i == DEGRAMATYZER_RULE_COUNT) {
+		hid_key(c, modifiers);
 	}
+	hid_end(modifiers);
 	
-	prev_c         = c;
-	prev_modifiers = modifiers;
+	state->prev_c         = c;
+	state->prev_modifiers = modifiers;
 }
 
-#define BUFFER_SIZE 32
-static int letter_counter = 0;
-static int letter_buffer[BUFFER_SIZE];
-static int modifiers_buffer[BUFFER_SIZE];
-const int hodor[5] = {KEY_H,KEY_O,KEY_D,KEY_O,KEY_R};
+const FlashTable<uint8_t, HODOR_SIZE> hodor PROGMEM = {HODOR_WORD};
 
 void hodorifier(int c, uint8_t modifiers)
 {
+	HodorState_t *state = &mode_state.hodor;
+
+	hid_begin();
 	if( c == KEY_BACKSPACE) {
-		if( --letter_counter < 0)
-			letter_counter = 0;
+		if( --state->letter_counter < 0)
+			state->letter_counter = 0;
 		
-		Keyboard.set_modifier(modifiers);
-		Keyboard.set_key1(c);
-		Keyboard.send_now();
-	} else if(c < KEY_A || c > KEY_0) {
-		if(letter_counter > 0) {
-			for(;letter_counter <= 5; letter_counter++) {
-				Keyboard.set_modifier(modifiers & ~MODIFIERKEY_RIGHT_ALT);
-				Keyboard.set_key1(hodor[letter_counter]);
-				Keyboard.send_now();
+		hid_key(c, modifiers);
+	} else if(!RULE_IS_LETTER(c & 0xFF)) {
+		if(state->letter_counter > 0) {
+			for(;state->letter_counter < HODOR_SIZE; state->letter_counter++) {
+				hid_key(hodor[state->letter_counter], modifiers & ~MODIFIERKEY_RIGHT_ALT);
 			}
 		}
-		Keyboard.set_key1(c);
-		Keyboard.send_now();
-		letter_counter = 0;
+		hid_key(c, modifiers);
+		state->letter_counter = 0;
 	} else {
-		if(letter_counter <= 5) {
-			Keyboard.set_modifier(modifiers & ~MODIFIERKEY_RIGHT_ALT);
-			Keyboard.set_key1(hodor[letter_counter]);
-			Keyboard.send_now();
-			letter_counter++;
+		if(state->letter_counter < HODOR_SIZE) {
+			hid_key(hodor[state->letter_counter], modifiers & ~MODIFIERKEY_RIGHT_ALT);
+			state->letter_counter++;
 		}
 	}
+	hid_end(modifiers);
 }
 
 void reverser(int c, uint8_t modifiers)
 {
+	ReverseState_t *state = &mode_state.reverse;
+
+	hid_begin();
 	if( c == KEY_BACKSPACE) {
-		if( --letter_counter < 0)
-			letter_counter = 0;
+		if( --state->letter_counter < 0)
+			state->letter_counter = 0;
 		
-		Keyboard.set_modifier(modifiers);
-		Keyboard.set_key1(c);
-		Keyboard.send_now();
-	} else if(c < KEY_A || c > KEY_0) {
-		Keyboard.set_modifier(0);
-		for(int i = 0; i < letter_counter; i++){
-			Keyboard.press(KEY_BACKSPACE);
-			Keyboard.release(KEY_BACKSPACE);
+		hid_key(c, modifiers);
+	} else if(!RULE_IS_LETTER(c & 0xFF)) {
+		for(int i = 0; i < state->letter_counter; i++){
+			hid_key(KEY_BACKSPACE, 0);
 		}
-		for(int i = letter_counter - 1; i >= 0; i--){
-			Keyboard.set_modifier(modifiers_buffer[letter_counter - i -1] & (MODIFIERKEY_LEFT_SHIFT | MODIFIERKEY_RIGHT_SHIFT) | 
-								  modifiers_buffer[i] & ~MODIFIERKEY_LEFT_SHIFT & ~MODIFIERKEY_RIGHT_SHIFT);
-			Keyboard.set_key1(letter_buffer[i]);
-			Keyboard.send_now();
+		for(int i = state->letter_counter - 1; i >= 0; i--){
+			hid_key(state->letter_buffer[i],
+			        state->modifiers_buffer[state->letter_counter - i -1] & (MODIFIERKEY_LEFT_SHIFT | MODIFIERKEY_RIGHT_SHIFT) | 
+			        state->modifiers_buffer[i] & ~MODIFIERKEY_LEFT_SHIFT & ~MODIFIERKEY_RIGHT_SHIFT);
 		}
-		Keyboard.set_modifier(modifiers);
-		Keyboard.set_key1(c);
-		Keyboard.send_now();
-		letter_counter = 0;
+		hid_key(c, modifiers);
+		state->letter_counter = 0;
 	} else {
-		if(letter_counter <= BUFFER_SIZE) {
-			letter_buffer[letter_counter] = c;
-			modifiers_buffer[letter_counter] = modifiers;
-			letter_counter++;
+		if(state->letter_counter < LETTER_BUFFER_SIZE) {
+			state->letter_buffer[state->letter_counter] = c;
+			state->modifiers_buffer[state->letter_counter] = modifiers;
+			state->letter_counter++;
 			
-			Keyboard.set_modifier(modifiers);
-			Keyboard.set_key1(c);
-			Keyboard.send_now();
+			hid_key(c, modifiers);
 		}
 	}
+	hid_end(modifiers);
 }
 
 #define DICTIONARY_SIZE 16
 #define WORD_SIZE 8
-const int tourette_dictionary[DICTIONARY_SIZE][WORD_SIZE] = {
-    {0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0},
-    {KEY_C,KEY_H,KEY_U,KEY_J,KEY_1,0,0,0},
-    {KEY_D,KEY_U,KEY_P,KEY_A,KEY_1,0,0,0},
-    {KEY_K,KEY_U,KEY_R,KEY_W,KEY_A,KEY_1,0,0},
-    {KEY_C,KEY_Y,KEY_C,KEY_K,KEY_I,KEY_1,0,0},
-    {KEY_J,KEY_E,KEY_B,KEY_A,KEY_C,KEY_1,0,0},
-    {KEY_K,KEY_U,KEY_T,KEY_A,KEY_S,KEY_1,0,0},
-    {KEY_S,KEY_Z,KEY_M,KEY_A,KEY_T,KEY_A,KEY_1,0},
-    {KEY_P,KEY_I,KEY_Z,KEY_D,KEY_A,KEY_1,0,0}
+const FlashTable<uint8_t, DICTIONARY_SIZE * WORD_SIZE> tourette_dictionary PROGMEM = {
+    0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,
+    KEY_C,KEY_H,KEY_U,KEY_J,KEY_1,0,0,0,
+    KEY_D,KEY_U,KEY_P,KEY_A,KEY_1,0,0,0,
+    KEY_K,KEY_U,KEY_R,KEY_W,KEY_A,KEY_1,0,0,
+    KEY_C,KEY_Y,KEY_C,KEY_K,KEY_I,KEY_1,0,0,
+    KEY_J,KEY_E,KEY_B,KEY_A,KEY_C,KEY_1,0,0,
+    KEY_K,KEY_U,KEY_T,KEY_A,KEY_S,KEY_1,0,0,
+    KEY_S,KEY_Z,KEY_M,KEY_A,KEY_T,KEY_A,KEY_1,0,
+    KEY_P,KEY_I,KEY_Z,KEY_D,KEY_A,KEY_1,0,0
 };
 
+#ifdef RAWHID_INTERFACE
+// Dictionary uploaded over raw HID, used instead of the built in one.
+// Chunks collect in upload_buffer and the whole table is switched over
+// once every byte of it has arrived, so a mode switch in the middle of
+// an upload never types a half written dictionary.
+#define DICTIONARY_BYTES (DICTIONARY_SIZE * WORD_SIZE)
+static uint8_t uploaded_dictionary[DICTIONARY_SIZE][WORD_SIZE];
+static bool dictionary_uploaded = false;
+static uint8_t upload_buffer[DICTIONARY_BYTES];
+static uint8_t upload_received[DICTIONARY_BYTES / 8];	// bit per byte
+
+bool PS2Keyboard::setTable(uint8_t table, uint8_t offset, const uint8_t *data, uint8_t length) {
+	uint8_t i;
+
+	if(table != CTRL_TABLE_TOURETTE || offset + length > DICTIONARY_BYTES)
+		return false;
+	memcpy(upload_buffer + offset, data, length);
+	for(i = offset; i < offset + length; i++)
+		upload_received[i / 8] |= 1 << (i % 8);
+	for(i = 0; i < sizeof(upload_received); i++) {
+		if(upload_received[i] != 0xFF)
+			return true;
+	}
+	memcpy(uploaded_dictionary, upload_buffer, sizeof(uploaded_dictionary));
+	memset(upload_received, 0, sizeof(upload_received));
+	dictionary_uploaded = true;
+	return true;
+}
+
+bool PS2Keyboard::resetTable(uint8_t table) {
+	if(table != CTRL_TABLE_TOURETTE)
+		return false;
+	memset(uploaded_dictionary, 0, sizeof(uploaded_dictionary));
+	memset(upload_received, 0, sizeof(upload_received));
+	dictionary_uploaded = false;
+	return true;
+}
+
+static inline int tourette_key(int dict, int i)
+{
+	if(dictionary_uploaded)
+		return uploaded_dictionary[dict][i];
+	return tourette_dictionary[dict * WORD_SIZE + i];
+}
+#else
+#define tourette_key(dict, i) tourette_dictionary[(dict) * WORD_SIZE + (i)]
+#endif
+
 void touretter(int c, uint8_t modifiers)
 {
+	hid_begin();
 	if( c == KEY_SPACE || c == KEY_ENTER || c == KEY_PERIOD || c == KEY_COMMA) {
-		Keyboard.set_modifier(0);
-		Keyboard.set_key1(KEY_SPACE);
-		Keyboard.send_now();
+		hid_key(KEY_SPACE, 0);
 		
 		int dict = random(0, DICTIONARY_SIZE);
-		Serial.println(dict);
-		for(int i = 0; tourette_dictionary[dict][i] != 0; i++) {
-			Keyboard.set_modifier(MODIFIERKEY_LEFT_SHIFT);
-			Keyboard.set_key1(tourette_dictionary[dict][i]);
-			Keyboard.send_now();
+		for(int i = 0; i < WORD_SIZE && tourette_key(dict, i) != 0; i++) {
+			hid_key(tourette_key(dict, i), (uint8_t)MODIFIERKEY_LEFT_SHIFT);
 		}
-		
-		Keyboard.set_modifier(modifiers);
-		Keyboard.set_key1(c);
-		Keyboard.send_now();
-	} else {
-		Keyboard.set_modifier(modifiers);
-		Keyboard.set_key1(c);
-		Keyboard.send_now();
 	}
+	hid_key(c, modifiers);
+	hid_end(modifiers);
+}
+
+static void set_mode(int m)
+{
+	if(m >= NUM_MODES)
+		m = NUM_MODES - 1;
+	if(m < 0)
+		m = 0;
+	mode_resets[m]();
+	mode = m;
 }
 
 static char get_iso8859_code(void)
@@ -436,31 +535,27 @@ static char get_iso8859_code(void)
                     Keyboard.set_modifier(modifiers);
                     Keyboard.send_now();
                 } else if (s == 0x6C && (state & MODIFIER)) {
-					Keyboard.release(KEY_HOME);
+					hid_release(KEY_HOME);
 				} else if (s == 0x69 && (state & MODIFIER)) {
-					Keyboard.release(KEY_END);
+					hid_release(KEY_END);
                 } else if (s == 0x7D && (state & MODIFIER)) {
-                    Keyboard.release(KEY_PAGE_UP);
+                    hid_release(KEY_PAGE_UP);
                 } else if (s == 0x7A && (state & MODIFIER)) {
-                    Keyboard.release(KEY_PAGE_DOWN);
+                    hid_release(KEY_PAGE_DOWN);
                 } else if (s ==0x75 && (state & MODIFIER)) {
-					Keyboard.release(KEY_UP);
+					hid_release(KEY_UP);
 				} else if (s ==0x6B && (state & MODIFIER)) {
-					Keyboard.release(KEY_LEFT);
+					hid_release(KEY_LEFT);
 				} else if (s ==0x72 && (state & MODIFIER)) {
-					Keyboard.release(KEY_DOWN);
+					hid_release(KEY_DOWN);
 				} else if (s ==0x74 && (state & MODIFIER)) {
-					Keyboard.release(KEY_RIGHT);
+					hid_release(KEY_RIGHT);
 				} else if (s == 0x71 && (state & MODIFIER)) {
-                    Keyboard.release(KEY_DELETE);
+                    hid_release(KEY_DELETE);
                 } else if (s == 0x32 && (state & MODIFIER)) { //vol up
-                    letter_counter = 0;
-                    if(++mode >= NUM_MODES)
-                        mode = NUM_MODES - 1;
+                    set_mode(mode + 1);
                 } else if (s == 0x21 && (state & MODIFIER)) { //vol down
-                    letter_counter = 0;
-                    if(--mode < 0)
-                        mode = 0;
+                    set_mode(mode - 1);
                 }
                 state &= ~(BREAK | MODIFIER);
                 continue;
@@ -506,44 +601,48 @@ static char get_iso8859_code(void)
             } else if (s == 0x21 && (state & MODIFIER)) { //vol down
                 continue;
             } else if (s == 0x6C && (state & MODIFIER)) {
-				Keyboard.press(KEY_HOME);
+				hid_press(KEY_HOME);
 				continue;
 			} else if (s == 0x69 && (state & MODIFIER)) {
-				Keyboard.press(KEY_END);
+				hid_press(KEY_END);
 				continue;
 			} else if (s == 0x7D && (state & MODIFIER)) {
-				Keyboard.press(KEY_PAGE_UP);
+				hid_press(KEY_PAGE_UP);
 				continue;
 			} else if (s == 0x7A && (state & MODIFIER)) {
-				Keyboard.press(KEY_PAGE_DOWN);
+				hid_press(KEY_PAGE_DOWN);
 				continue;
 			} else if (s ==0x75 && (state & MODIFIER)) {
-				Keyboard.press(KEY_UP);
+				hid_press(KEY_UP);
 				continue;
 			} else if (s ==0x6B && (state & MODIFIER)) {
-				Keyboard.press(KEY_LEFT);
+				hid_press(KEY_LEFT);
 				continue;
 			} else if (s ==0x72 && (state & MODIFIER)) {
-				Keyboard.press(KEY_DOWN);
+				hid_press(KEY_DOWN);
 				continue;
 			} else if (s ==0x74 && (state & MODIFIER)) {
-				Keyboard.press(KEY_RIGHT);
+				hid_press(KEY_RIGHT);
 				continue;
 			} else if (s == 0x71 && (state & MODIFIER)) {
-				Keyboard.press(KEY_DELETE);
+				hid_press(KEY_DELETE);
 				continue;
 			}
             c = 0;
 
 			if (s < PS2_KEYMAP_SIZE) {
 				c = ps2_to_usb_map[s];
+				if (c) c |= KEY_FLAGS;
 			}
 
+			uint32_t reports = hid_report_count;
+			key_count++;
 			modes[mode](c, modifiers);
+			reports = hid_report_count - reports;
+			if (reports >= REPORT_HISTOGRAM_SIZE)
+				reports = REPORT_HISTOGRAM_SIZE - 1;
+			report_histogram[reports]++;
 
-            Keyboard.set_key1(0);
-            Keyboard.send_now();
-            
             state &= ~(BREAK | MODIFIER);
             if (c) return c;
         }
@@ -584,72 +683,51 @@ PS2Keyboard::PS2Keyboard() {
 }
 
 void PS2Keyboard::begin(uint8_t data_pin, uint8_t irq_pin) {
-  uint8_t irq_num=255;
+  head = 0;
+  tail = 0;
+  source->begin(data_pin, irq_pin);
+}
 
-  DataPin = data_pin;
+void PS2Keyboard::getStats(PS2Stats_t *stats) {
+  noInterrupts();
+  stats->interrupts = ps2_irq_count;
+  stats->frames = ps2_frame_count;
+  stats->frame_errors = ps2_frame_errors;
+  stats->ring_drops = ps2_ring_drops;
+  stats->inhibits = ps2_inhibit_count;
+  interrupts();
+  stats->keystrokes = key_count;
+  stats->reports = hid_report_count;
+  for (uint8_t i = 0; i < REPORT_HISTOGRAM_SIZE; i++) {
+    stats->reports_per_key[i] = report_histogram[i];
+  }
+}
 
-  // initialize the pins
-#ifdef INPUT_PULLUP
-  pinMode(irq_pin, INPUT_PULLUP);
-  pinMode(data_pin, INPUT_PULLUP);
+void PS2Keyboard::tableSavings(uint16_t *flash_saved, uint16_t *ram_saved) {
+  // the tables used to be int arrays, and the mode table not const
+  const uint16_t int_bytes = sizeof(int) *
+    (PS2_KEYMAP_SIZE + HODOR_SIZE + DICTIONARY_SIZE * WORD_SIZE);
+  const uint16_t mode_bytes = sizeof(mode_fn_t) * NUM_MODES;
+  const uint16_t table_bytes = sizeof(ps2_to_usb_map) + sizeof(hodor) +
+    sizeof(tourette_dictionary) + sizeof(modes);
+
+  // initialised RAM costs its image in flash as well
+  *flash_saved = int_bytes + mode_bytes - table_bytes;
+#if defined(__AVR__)
+  *ram_saved = int_bytes + mode_bytes;
 #else
-  pinMode(irq_pin, INPUT);
-  digitalWrite(irq_pin, HIGH);
-  pinMode(data_pin, INPUT);
-  digitalWrite(data_pin, HIGH);
+  *ram_saved = mode_bytes;
 #endif
+}
 
-#ifdef CORE_INT_EVERY_PIN
-  irq_num = irq_pin;
+uint8_t PS2Keyboard::getMode() {
+  return mode;
+}
 
-#else
-  switch(irq_pin) {
-    #ifdef CORE_INT0_PIN
-    case CORE_INT0_PIN:
-      irq_num = 0;
-      break;
-    #endif
-    #ifdef CORE_INT1_PIN
-    case CORE_INT1_PIN:
-      irq_num = 1;
-      break;
-    #endif
-    #ifdef CORE_INT2_PIN
-    case CORE_INT2_PIN:
-      irq_num = 2;
-      break;
-    #endif
-    #ifdef CORE_INT3_PIN
-    case CORE_INT3_PIN:
-      irq_num = 3;
-      break;
-    #endif
-    #ifdef CORE_INT4_PIN
-    case CORE_INT4_PIN:
-      irq_num = 4;
-      break;
-    #endif
-    #ifdef CORE_INT5_PIN
-    case CORE_INT5_PIN:
-      irq_num = 5;
-      break;
-    #endif
-    #ifdef CORE_INT6_PIN
-    case CORE_INT6_PIN:
-      irq_num = 6;
-      break;
-    #endif
-    #ifdef CORE_INT7_PIN
-    case CORE_INT7_PIN:
-      irq_num = 7;
-      break;
-    #endif
-  }
-#endif
+uint8_t PS2Keyboard::modeCount() {
+  return NUM_MODES;
+}
 
-  head = 0;
-  tail = 0;
-  if (irq_num < 255) {
-    attachInterrupt(irq_num, ps2interrupt, FALLING);
-  }
+void PS2Keyboard::setMode(uint8_t m) {
+  set_mode(m);
 }
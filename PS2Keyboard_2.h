@@ -172,6 +172,22 @@ typedef struct {
 } PS2Keymap_t;
 
 
+#define REPORT_HISTOGRAM_SIZE 8
+
+// Receive path counters.  interrupts / keystrokes is the ISR load per
+// key press; with the edge source it is 33 (make + break, 11 bits each).
+typedef struct {
+	uint32_t interrupts;
+	uint32_t frames;
+	uint32_t frame_errors;
+	uint32_t ring_drops;
+	uint32_t inhibits;	// times the keyboard was held off, buffer full
+	uint32_t keystrokes;
+	uint32_t reports;	// USB keyboard reports sent
+	uint32_t reports_per_key[REPORT_HISTOGRAM_SIZE];	// last bucket: 7 or more
+} PS2Stats_t;
+
+
 extern const PROGMEM PS2Keymap_t PS2Keymap_US;
 extern const PROGMEM PS2Keymap_t PS2Keymap_German;
 extern const PROGMEM PS2Keymap_t PS2Keymap_French;
@@ -206,6 +222,35 @@ class PS2Keyboard {
      * If there is no char availble, -1 is returned.
      */
     static int read();
+
+    /**
+     * Copies the receive path counters into stats.
+     */
+    static void getStats(PS2Stats_t *stats);
+
+    /**
+     * Bytes of flash and RAM the lookup tables take less than they did
+     * as int arrays, see FlashTable.h.
+     */
+    static void tableSavings(uint16_t *flash_saved, uint16_t *ram_saved);
+
+    /**
+     * Current mode, 0 (pass through) to modeCount() - 1.  setMode() does
+     * the same as stepping with the volume keys.
+     */
+    static uint8_t getMode();
+    static uint8_t modeCount();
+    static void setMode(uint8_t mode);
+
+#ifdef RAWHID_INTERFACE
+    /**
+     * Replaces a lookup table with uploaded data, or goes back to the
+     * built in one.  Tables are numbered as in ControlProtocol.h.  The
+     * upload takes effect once every byte of the table has been set.
+     */
+    static bool setTable(uint8_t table, uint8_t offset, const uint8_t *data, uint8_t length);
+    static bool resetTable(uint8_t table);
+#endif
 };
 
 #endif
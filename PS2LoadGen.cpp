@@ -0,0 +1,321 @@
+/*
+  PS2LoadGen.cpp - synthetic scan code load for throughput testing
+
+  The runner injects whatever is due at the configured rate, holding
+  back while the keyboard is inhibited unless told not to, then lets
+  the pipeline take one key.  Every key make gets its injection time
+  queued; each time available() comes back true the oldest one is
+  taken, so the latency covers the wait in the ring, the mode function
+  and its USB reports.  Latencies go into a log histogram, four buckets
+  per octave, halved when a bucket fills so the shape survives long runs.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include "PS2LoadGen.h"
+#include "PS2Keyboard_2.h"
+#include "PS2FrameSource.h"
+#include "FlashTable.h"
+
+#define SCAN_RELEASE	0xF0
+#define SCAN_EXTENDED	0xE0
+#define SCAN_SHIFT	0x12
+#define SCAN_SPACE	0x29
+#define SCAN_VOL_UP	0x32
+#define SCAN_VOL_DOWN	0x21
+
+#define LETTERS 26
+
+// a to z, set 2
+const FlashTable<uint8_t, LETTERS> load_letters PROGMEM = {
+	0x1C, 0x32, 0x21, 0x23, 0x24, 0x2B, 0x34, 0x33, 0x43, 0x3B,
+	0x42, 0x4B, 0x3A, 0x31, 0x44, 0x4D, 0x15, 0x2D, 0x1B, 0x2C,
+	0x3C, 0x2A, 0x1D, 0x22, 0x35, 0x1A
+};
+
+// Injection times of keys still in the ring, more than it can hold
+#define LOAD_STAMPS 64
+
+// 4 buckets per octave up to 2^20 us, anything slower goes in the last
+#define LATENCY_BUCKETS 80
+
+// Injected per pass when there is no rate and inhibits are ignored
+#define LOAD_BATCH 8
+
+static uint32_t stamps[LOAD_STAMPS];
+static uint8_t stamp_head;
+static uint8_t stamp_count;
+static uint16_t latency_histogram[LATENCY_BUCKETS];
+
+static uint32_t next_random(PS2LoadGen_t *gen, uint32_t range)
+{
+	gen->rng ^= gen->rng << 13;
+	gen->rng ^= gen->rng >> 17;
+	gen->rng ^= gen->rng << 5;
+	return gen->rng % range;
+}
+
+static void push(PS2LoadGen_t *gen, uint8_t code, bool is_key)
+{
+	if (is_key) gen->keys |= (uint32_t)1 << gen->count;
+	gen->queue[gen->count++] = code;
+}
+
+static void tap(PS2LoadGen_t *gen, uint8_t code)
+{
+	push(gen, code, true);
+	push(gen, SCAN_RELEASE, false);
+	push(gen, code, false);
+}
+
+static void volume_key(PS2LoadGen_t *gen, uint8_t code)
+{
+	push(gen, SCAN_EXTENDED, false);
+	push(gen, code, false);
+	push(gen, SCAN_EXTENDED, false);
+	push(gen, SCAN_RELEASE, false);
+	push(gen, code, false);
+}
+
+static void burst_step(PS2LoadGen_t *gen)
+{
+	uint8_t n = 1 + next_random(gen, 8);
+	bool shifted = next_random(gen, 4) == 0;
+
+	for (uint8_t i = 0; i < n; i++) {
+		if (i == 0 && shifted) push(gen, SCAN_SHIFT, false);
+		tap(gen, load_letters[next_random(gen, LETTERS)]);
+		if (i == 0 && shifted) {
+			push(gen, SCAN_RELEASE, false);
+			push(gen, SCAN_SHIFT, false);
+		}
+	}
+	tap(gen, SCAN_SPACE);
+}
+
+static void rollover_step(PS2LoadGen_t *gen)
+{
+	uint8_t n = 2 + next_random(gen, 3);
+	uint8_t first = next_random(gen, LETTERS);
+	uint8_t i;
+
+	// 7 apart, so up to 4 of them are distinct
+	for (i = 0; i < n; i++) {
+		push(gen, load_letters[(first + 7 * i) % LETTERS], true);
+	}
+	for (i = 0; i < n; i++) {
+		push(gen, SCAN_RELEASE, false);
+		push(gen, load_letters[(first + 7 * i) % LETTERS], false);
+	}
+}
+
+static void repeat_step(PS2LoadGen_t *gen)
+{
+	uint8_t n = 4 + next_random(gen, 9);
+	uint8_t code = load_letters[next_random(gen, LETTERS)];
+
+	for (uint8_t i = 0; i < n; i++) push(gen, code, true);
+	push(gen, SCAN_RELEASE, false);
+	push(gen, code, false);
+}
+
+static void mode_switch_step(PS2LoadGen_t *gen)
+{
+	tap(gen, load_letters[next_random(gen, LETTERS)]);
+	// modes act on the break; a pair that ends where it started
+	if (gen->mode + 1 < gen->mode_count) {
+		volume_key(gen, SCAN_VOL_UP);
+		volume_key(gen, SCAN_VOL_DOWN);
+	} else {
+		volume_key(gen, SCAN_VOL_DOWN);
+		volume_key(gen, SCAN_VOL_UP);
+	}
+}
+
+static void refill(PS2LoadGen_t *gen)
+{
+	uint8_t pattern = gen->pattern;
+
+	gen->head = 0;
+	gen->count = 0;
+	gen->keys = 0;
+	if (pattern == LOAD_MIX) {
+		static const uint8_t mix[8] = {
+			LOAD_BURST, LOAD_BURST, LOAD_BURST, LOAD_BURST,
+			LOAD_ROLLOVER, LOAD_ROLLOVER, LOAD_REPEAT, LOAD_MODE_SWITCH
+		};
+		pattern = mix[next_random(gen, 8)];
+	}
+	switch (pattern) {
+	case LOAD_ROLLOVER:
+		rollover_step(gen);
+		break;
+	case LOAD_REPEAT:
+		repeat_step(gen);
+		break;
+	case LOAD_MODE_SWITCH:
+		mode_switch_step(gen);
+		break;
+	default:
+		burst_step(gen);
+		break;
+	}
+}
+
+void ps2_loadgen_begin(PS2LoadGen_t *gen, uint8_t pattern, uint32_t seed,
+		       uint8_t mode, uint8_t mode_count)
+{
+	gen->rng = seed ? seed : 1;
+	gen->keys = 0;
+	gen->head = 0;
+	gen->count = 0;
+	gen->pattern = pattern < LOAD_PATTERNS ? pattern : LOAD_MIX;
+	gen->mode = mode;
+	gen->mode_count = mode_count;
+}
+
+uint8_t ps2_loadgen_next(PS2LoadGen_t *gen, bool *is_key)
+{
+	if (gen->head == gen->count) refill(gen);
+	*is_key = (gen->keys >> gen->head) & 1;
+	return gen->queue[gen->head++];
+}
+
+bool ps2_loadgen_idle(const PS2LoadGen_t *gen)
+{
+	return gen->head == gen->count;
+}
+
+static uint8_t latency_bucket(uint32_t us)
+{
+	uint8_t msb = 0;
+
+	if (us < 4) return us;
+	for (uint32_t v = us; v > 1; v >>= 1) msb++;
+	if (msb > LATENCY_BUCKETS / 4) return LATENCY_BUCKETS - 1;
+	return (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+}
+
+// Smallest latency that lands in the bucket
+static uint32_t bucket_floor(uint8_t b)
+{
+	if (b < 4) return b;
+	return (uint32_t)(4 + (b & 3)) << (b / 4 - 1);
+}
+
+static void record_latency(uint32_t us)
+{
+	uint8_t b = latency_bucket(us);
+
+	if (latency_histogram[b] == 0xFFFF) {
+		for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+			latency_histogram[i] = (latency_histogram[i] + 1) / 2;
+		}
+	}
+	latency_histogram[b]++;
+}
+
+static uint32_t percentile(uint8_t percent)
+{
+	uint32_t total = 0, seen = 0;
+	uint8_t b;
+
+	for (b = 0; b < LATENCY_BUCKETS; b++) total += latency_histogram[b];
+	if (!total) return 0;
+	for (b = 0; b < LATENCY_BUCKETS; b++) {
+		seen += latency_histogram[b];
+		if (seen * 100 >= total * percent) break;
+	}
+	return bucket_floor(b);
+}
+
+static void push_stamp(uint32_t now)
+{
+	if (stamp_count == LOAD_STAMPS) return;	// dropped anyway, or nearly
+	stamps[(stamp_head + stamp_count) % LOAD_STAMPS] = now;
+	stamp_count++;
+}
+
+static bool pop_stamp(uint32_t *stamp)
+{
+	if (!stamp_count) return false;
+	*stamp = stamps[stamp_head];
+	stamp_head = (stamp_head + 1) % LOAD_STAMPS;
+	stamp_count--;
+	return true;
+}
+
+void ps2_load_test(const PS2LoadConfig_t *config, uint8_t mode, PS2LoadResult_t *result)
+{
+	PS2LoadGen_t gen;
+	PS2Stats_t before, after;
+	uint32_t injected = 0, keys = 0, latency_max = 0;
+	uint32_t start, elapsed, due, stamp;
+	const uint32_t duration_us = config->duration_ms * 1000;
+	bool ignore_inhibit = config->flags & LOAD_IGNORE_INHIBIT;
+	bool running = true, is_key;
+	uint8_t code;
+
+	PS2Keyboard::setMode(mode);
+	ps2_loadgen_begin(&gen, config->pattern, config->seed, mode, PS2Keyboard::modeCount());
+	memset(latency_histogram, 0, sizeof(latency_histogram));
+	stamp_head = 0;
+	stamp_count = 0;
+
+	PS2Keyboard::getStats(&before);
+	start = micros();
+	while (1) {
+		elapsed = micros() - start;
+		if (running && elapsed >= duration_us && ps2_loadgen_idle(&gen)) {
+			running = false;
+		}
+		if (running) {
+			if (config->rate) {
+				due = (uint64_t)elapsed * config->rate / 1000000;
+			} else {
+				due = injected + LOAD_BATCH;
+			}
+			// past the duration only the step in progress is finished
+			while (injected < due && (ignore_inhibit || !ps2_inhibited) &&
+			       (elapsed < duration_us || !ps2_loadgen_idle(&gen))) {
+				code = ps2_loadgen_next(&gen, &is_key);
+				noInterrupts();
+				ps2_sim_scan_code(code);
+				interrupts();
+				if (is_key) push_stamp(micros());
+				injected++;
+			}
+		}
+
+		if (PS2Keyboard::available()) {
+			PS2Keyboard::read();
+			keys++;
+			if (pop_stamp(&stamp)) {
+				uint32_t latency = micros() - stamp;
+				record_latency(latency);
+				if (latency > latency_max) latency_max = latency;
+			}
+		} else {
+			// ring empty: stamps left over belong to dropped keys
+			stamp_head = 0;
+			stamp_count = 0;
+			if (!running) break;
+		}
+	}
+	elapsed = micros() - start;
+	PS2Keyboard::getStats(&after);
+
+	result->scan_codes = injected;
+	result->keys = keys;
+	result->elapsed_us = elapsed;
+	result->ring_drops = after.ring_drops - before.ring_drops;
+	result->inhibits = after.inhibits - before.inhibits;
+	result->reports = after.reports - before.reports;
+	result->latency_p50_us = percentile(50);
+	result->latency_p90_us = percentile(90);
+	result->latency_p99_us = percentile(99);
+	result->latency_max_us = latency_max;
+}
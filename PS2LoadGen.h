@@ -0,0 +1,99 @@
+/*
+  PS2LoadGen.h - synthetic scan code load for throughput testing
+
+  A pattern generator and a runner that feeds it into the receive ring,
+  through ps2_sim_scan_code(), at a set rate.  Everything after the ring
+  is the real thing: get_iso8859_code(), the mode function and the USB
+  reports, so on the device the test types into whatever window has the
+  focus.  Do not type on the PS/2 keyboard while it runs, its scan codes
+  would end up in the same ring.
+
+  The generator only deals in scan codes and the runner only in the
+  PS2Keyboard interface, so extras/degramd runs the same test on Linux.
+  This header only depends on <stdint.h> for the same reason.
+
+  Patterns, every step leaves all keys released:
+     LOAD_BURST        words of 1 to 8 letter taps and a space, some
+                       with a shifted first letter
+     LOAD_ROLLOVER     2 to 4 letters pressed together, released in order
+     LOAD_REPEAT       one letter held through 4 to 12 typematic repeats
+     LOAD_MODE_SWITCH  a letter tap, then volume up and volume down (the
+                       other way round in the last mode), which switches
+                       the mode and back
+     LOAD_MIX          all of the above, mostly bursts
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef PS2LoadGen_h
+#define PS2LoadGen_h
+
+#include <stdint.h>
+
+#define LOAD_BURST		0
+#define LOAD_ROLLOVER		1
+#define LOAD_REPEAT		2
+#define LOAD_MODE_SWITCH	3
+#define LOAD_MIX		4
+#define LOAD_PATTERNS		5
+
+// Longest step: 8 shifted letter taps and a space
+#define LOAD_QUEUE_SIZE 32
+
+typedef struct {
+	uint32_t rng;
+	uint32_t keys;		// bit i set: queue[i] is a key make
+	uint8_t queue[LOAD_QUEUE_SIZE];
+	uint8_t head;
+	uint8_t count;
+	uint8_t pattern;
+	uint8_t mode;		// mode the volume key pairs start from
+	uint8_t mode_count;
+} PS2LoadGen_t;
+
+void ps2_loadgen_begin(PS2LoadGen_t *gen, uint8_t pattern, uint32_t seed,
+		       uint8_t mode, uint8_t mode_count);
+
+// Next scan code.  *is_key is set for makes that reach the mode
+// function, each of them makes PS2Keyboard::available() true once.
+uint8_t ps2_loadgen_next(PS2LoadGen_t *gen, bool *is_key);
+
+// True between steps, when all keys are up
+bool ps2_loadgen_idle(const PS2LoadGen_t *gen);
+
+// Flags
+#define LOAD_IGNORE_INHIBIT	0x01	// keep injecting while the keyboard is held off
+
+typedef struct {
+	uint8_t pattern;
+	uint8_t flags;
+	uint32_t rate;		// scan codes per second, 0: as fast as the ring takes them
+	uint32_t duration_ms;	// per mode
+	uint32_t seed;
+} PS2LoadConfig_t;
+
+typedef struct {
+	uint32_t scan_codes;
+	uint32_t keys;
+	uint32_t elapsed_us;
+	uint32_t ring_drops;
+	uint32_t inhibits;
+	uint32_t reports;
+	// scan code queued to the mode function done with it, reports sent
+	uint32_t latency_p50_us;
+	uint32_t latency_p90_us;
+	uint32_t latency_p99_us;
+	uint32_t latency_max_us;
+} PS2LoadResult_t;
+
+/**
+ * Runs the load in one mode until duration_ms is up and the step in
+ * progress is done, then until the ring is empty.  Leaves that mode set.
+ * Latencies are approximate once frames have been dropped.
+ */
+void ps2_load_test(const PS2LoadConfig_t *config, uint8_t mode, PS2LoadResult_t *result);
+
+#endif
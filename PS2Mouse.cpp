@@ -0,0 +1,423 @@
+/*
+  PS2Mouse.cpp - PS/2 mouse relayed as a USB mouse
+
+  Receiving works like the keyboard's edge source: one interrupt per
+  falling clock edge, 11 bits make a frame.  To send, the clock is held
+  low, data is pulled low as the start bit and the clock let go; the
+  mouse then clocks the byte in and the same interrupt puts one bit on
+  the data line per falling edge, ending with the mouse's acknowledge.
+
+  Packet, byte 0:  bit 0..2 left, right, middle, bit 3 always 1,
+                   bit 4/5 X/Y sign, bit 6/7 X/Y overflow
+          byte 1/2: X, Y (up is positive)
+          byte 3:   wheel, only in IntelliMouse mode: the whole byte
+                    with id 3, the low 4 bits with id 4 (Explorer), whose
+                    bit 4/5 are buttons 4 and 5, not relayed
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include "PS2Mouse.h"
+#include "PS2FrameSource.h"
+
+#ifdef MOUSE_INTERFACE
+
+#define CMD_RESET		0xFF
+#define CMD_RESEND		0xFE
+#define CMD_SET_SAMPLE_RATE	0xF3
+#define CMD_GET_DEVICE_ID	0xF2
+#define CMD_ENABLE_REPORTING	0xF4
+#define CMD_SET_RESOLUTION	0xE8
+#define REPLY_ACK		0xFA
+#define REPLY_SELF_TEST_PASSED	0xAA
+
+// A packet whose bytes are further apart than this is a broken one
+#define PACKET_GAP_US 20000
+// USB full speed polls the mouse once per frame
+#define REPORT_INTERVAL_US 1000
+
+static uint8_t DataPin;
+static uint8_t IrqPin;
+
+// receive state
+static volatile uint8_t bitcount=0;
+static volatile uint16_t incoming=0;
+static volatile uint8_t holding_clock=0;
+
+// send state, TX_IDLE when receiving
+#define TX_IDLE 0xFF
+static volatile uint8_t tx_bit=TX_IDLE;
+static volatile uint16_t tx_frame;
+static volatile uint8_t tx_ack;
+
+// replies during setup, before streaming starts
+#define REPLY_SIZE 8
+static volatile uint8_t reply[REPLY_SIZE];
+static volatile uint8_t reply_head, reply_tail;
+
+// packet decoding, once streaming
+static volatile uint8_t streaming=0;
+static uint8_t packet_size=3;
+static uint8_t device_id=0;
+static uint8_t packet[4];
+static uint8_t packet_index=0;
+static uint32_t last_byte_us;
+
+// motion not yet sent over USB
+static volatile int32_t acc_x, acc_y, acc_wheel;
+static volatile uint8_t acc_buttons;
+static volatile uint8_t acc_pending=0;
+static volatile uint32_t acc_first_us;
+
+static uint8_t sent_buttons=0;
+static uint32_t last_report_us;
+
+static volatile PS2MouseStats_t stats;
+static uint32_t latency_count=0;
+static uint64_t latency_total_us=0;
+
+static inline void release_line(uint8_t pin)
+{
+#ifdef INPUT_PULLUP
+    pinMode(pin, INPUT_PULLUP);
+#else
+    pinMode(pin, INPUT);
+    digitalWrite(pin, HIGH);
+#endif
+}
+
+static inline void pull_line_low(uint8_t pin)
+{
+    digitalWrite(pin, LOW);
+    pinMode(pin, OUTPUT);
+}
+
+static void mouse_packet(void)
+{
+    uint8_t flags = packet[0];
+    uint32_t now_us = micros();
+
+    stats.packets++;
+    if (flags & 0xC0) {
+        stats.overflows++;
+    } else {
+        acc_x += (int16_t)packet[1] - ((flags & 0x10) ? 256 : 0);
+        acc_y += (int16_t)packet[2] - ((flags & 0x20) ? 256 : 0);
+    }
+    if (device_id == 4) {
+        acc_wheel += (int8_t)(packet[3] << 4) >> 4;
+    } else if (packet_size == 4) {
+        acc_wheel += (int8_t)packet[3];
+    }
+    acc_buttons = flags & 0x07;
+    if (!acc_pending) {
+        acc_pending = 1;
+        acc_first_us = now_us;
+    }
+}
+
+static void mouse_byte(uint8_t b)
+{
+    uint32_t now_us;
+
+    if (!streaming) {
+        uint8_t i = reply_head + 1;
+        if (i >= REPLY_SIZE) i = 0;
+        if (i != reply_tail) {
+            reply[i] = b;
+            reply_head = i;
+        }
+        return;
+    }
+
+    now_us = micros();
+    if (packet_index && now_us - last_byte_us > PACKET_GAP_US) {
+        stats.resyncs++;
+        packet_index = 0;
+    }
+    last_byte_us = now_us;
+    if (packet_index == 0 && !(b & 0x08)) {
+        // can't be the first byte of a packet
+        stats.resyncs++;
+        return;
+    }
+    packet[packet_index++] = b;
+    if (packet_index == packet_size) {
+        packet_index = 0;
+        mouse_packet();
+    }
+}
+
+#if PS2_FRAME_SOURCE == PS2_FRAME_SOURCE_SIM
+void ps2_mouse_sim_byte(uint8_t b)
+{
+    mouse_byte(b);
+}
+
+bool PS2Mouse::begin(uint8_t data_pin, uint8_t irq_pin) {
+    DataPin = data_pin;
+    IrqPin = irq_pin;
+    packet_size = 4;
+    device_id = 3;
+    packet_index = 0;
+    streaming = 1;
+    last_report_us = micros();
+    return true;
+}
+#else
+
+static uint8_t irq_num=255;
+
+// The ISR for the mouse clock line
+static void ps2mouse_interrupt(void)
+{
+    static uint32_t prev_ms=0;
+    uint32_t now_ms;
+    uint8_t val;
+
+    if (holding_clock) return;  // our own falling edge
+
+    if (tx_bit != TX_IDLE) {
+        if (tx_bit < 9) {
+            // 8 data bits and parity
+            if (tx_frame & (1 << tx_bit)) release_line(DataPin);
+            else pull_line_low(DataPin);
+        } else if (tx_bit == 9) {
+            release_line(DataPin);  // stop bit
+        } else {
+            tx_ack = !digitalRead(DataPin);
+            tx_bit = TX_IDLE;
+            bitcount = 0;
+            incoming = 0;
+            return;
+        }
+        tx_bit++;
+        return;
+    }
+
+    val = digitalRead(DataPin);
+    now_ms = millis();
+    if (now_ms - prev_ms > 250) {
+        bitcount = 0;
+        incoming = 0;
+    }
+    prev_ms = now_ms;
+    incoming |= (uint16_t)val << bitcount;
+    bitcount++;
+    if (bitcount == PS2_FRAME_BITS) {
+        if (ps2_frame_valid(incoming)) {
+            mouse_byte((uint8_t)(incoming >> 1));
+        } else {
+            stats.frame_errors++;
+        }
+        bitcount = 0;
+        incoming = 0;
+    }
+}
+
+static int read_reply(uint16_t timeout_ms)
+{
+    uint32_t start = millis();
+    uint8_t i;
+
+    while (reply_head == reply_tail) {
+        if (millis() - start > timeout_ms) return -1;
+    }
+    i = reply_tail + 1;
+    if (i >= REPLY_SIZE) i = 0;
+    reply_tail = i;
+    return reply[i];
+}
+
+static bool send_byte(uint8_t b)
+{
+    uint32_t start;
+
+    // frame without the start bit: data, parity, stop
+    tx_frame = ps2_make_frame(b) >> 1;
+    tx_ack = 0;
+
+    holding_clock = 1;
+    pull_line_low(IrqPin);
+    delayMicroseconds(120);
+    pull_line_low(DataPin);     // start bit
+    tx_bit = 0;
+    holding_clock = 0;
+    release_line(IrqPin);
+    // pinMode() on Teensy 3 clears the pin's interrupt config as well
+    attachInterrupt(irq_num, ps2mouse_interrupt, FALLING);
+
+    // the mouse has 15 ms to start clocking and 2 ms for the byte
+    start = millis();
+    while (tx_bit != TX_IDLE) {
+        if (millis() - start > 20) {
+            tx_bit = TX_IDLE;
+            release_line(DataPin);
+            return false;
+        }
+    }
+    return tx_ack;
+}
+
+// Sends a command and waits for its acknowledge, resending if asked to
+static bool command(uint8_t cmd)
+{
+    for (uint8_t tries = 0; tries < 3; tries++) {
+        if (!send_byte(cmd)) continue;
+        int r = read_reply(25);
+        if (r == REPLY_ACK) return true;
+        if (r != CMD_RESEND) return false;
+    }
+    return false;
+}
+
+static bool set_sample_rate(uint8_t rate)
+{
+    return command(CMD_SET_SAMPLE_RATE) && command(rate);
+}
+
+bool PS2Mouse::begin(uint8_t data_pin, uint8_t irq_pin) {
+    int id;
+
+    DataPin = data_pin;
+    IrqPin = irq_pin;
+    release_line(irq_pin);
+    release_line(data_pin);
+
+    reply_head = 0;
+    reply_tail = 0;
+    streaming = 0;
+    irq_num = ps2_irq_number(irq_pin);
+    if (irq_num == 255) return false;
+    attachInterrupt(irq_num, ps2mouse_interrupt, FALLING);
+
+    if (!command(CMD_RESET)) return false;
+    // self test takes up to 500 ms, then the device id
+    if (read_reply(1000) != REPLY_SELF_TEST_PASSED) return false;
+    read_reply(25);
+
+    // the IntelliMouse knock: 200, 100, 80 turns the wheel on
+    if (!set_sample_rate(200) || !set_sample_rate(100) || !set_sample_rate(80))
+        return false;
+    if (!command(CMD_GET_DEVICE_ID)) return false;
+    id = read_reply(25);
+    device_id = id < 0 ? 0 : id;
+    packet_size = (id == 3 || id == 4) ? 4 : 3;
+
+    if (!set_sample_rate(PS2_MOUSE_SAMPLE_RATE)) return false;
+    if (!command(CMD_SET_RESOLUTION) || !command(3)) return false;    // 8/mm
+
+    if (!command(CMD_ENABLE_REPORTING)) return false;
+    packet_index = 0;
+    streaming = 1;
+    last_report_us = micros();
+    return true;
+}
+#endif
+
+bool PS2Mouse::hasWheel() {
+    return packet_size == 4;
+}
+
+// One report with both, the motion having happened with the buttons in
+// their new state, as the PS/2 packet has it
+static void send_report(uint8_t buttons, int8_t dx, int8_t dy, int8_t dw)
+{
+#ifdef CORE_MOUSE_BUTTONS_STATE
+    usb_mouse_buttons_state = buttons;
+    Mouse.move(dx, dy, dw);
+    stats.reports++;
+#else
+    if (dx || dy || dw) {
+        Mouse.move(dx, dy, dw);
+        stats.reports++;
+    }
+    if (buttons != sent_buttons) {
+        Mouse.set_buttons(buttons & 0x01, (buttons >> 2) & 0x01, (buttons >> 1) & 0x01);
+        stats.reports++;
+    }
+#endif
+    sent_buttons = buttons;
+}
+
+static inline int8_t take(int32_t *acc)
+{
+    int32_t v = *acc;
+
+    if (v > 127) v = 127;
+    if (v < -127) v = -127;
+    *acc -= v;
+    return v;
+}
+
+void PS2Mouse::update() {
+    int32_t x, y, wheel;
+    uint8_t buttons;
+    uint32_t first_us, now_us;
+
+    now_us = micros();
+    if (!acc_pending || now_us - last_report_us < REPORT_INTERVAL_US) return;
+
+    noInterrupts();
+    x = acc_x;
+    y = acc_y;
+    wheel = acc_wheel;
+    buttons = acc_buttons;
+    first_us = acc_first_us;
+    acc_x = 0;
+    acc_y = 0;
+    acc_wheel = 0;
+    acc_pending = 0;
+    interrupts();
+
+    // USB Y grows downwards and a positive wheel scrolls up, PS/2 has
+    // both the other way round
+    int8_t dx = take(&x);
+    int8_t dy = -take(&y);
+    int8_t dw = -take(&wheel);
+
+    if (buttons != sent_buttons || dx || dy || dw) {
+        send_report(buttons, dx, dy, dw);
+    }
+    last_report_us = micros();
+
+    // more than one report's worth: keep the rest for the next poll
+    if (x || y || wheel) {
+        noInterrupts();
+        acc_x += x;
+        acc_y += y;
+        acc_wheel += wheel;
+        if (!acc_pending) {
+            acc_pending = 1;
+            acc_first_us = first_us;
+        }
+        interrupts();
+        return;
+    }
+
+    uint32_t latency = last_report_us - first_us;
+    if (latency > stats.latency_max_us) stats.latency_max_us = latency;
+    latency_total_us += latency;
+    latency_count++;
+}
+
+bool PS2Mouse::pending() {
+    return acc_pending;
+}
+
+void PS2Mouse::getStats(PS2MouseStats_t *s) {
+    noInterrupts();
+    s->packets = stats.packets;
+    s->frame_errors = stats.frame_errors;
+    s->resyncs = stats.resyncs;
+    s->overflows = stats.overflows;
+    s->reports = stats.reports;
+    s->latency_max_us = stats.latency_max_us;
+    interrupts();
+    s->latency_avg_us = latency_count ? latency_total_us / latency_count : 0;
+}
+
+#endif
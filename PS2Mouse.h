@@ -0,0 +1,78 @@
+/*
+  PS2Mouse.h - PS/2 mouse relayed as a USB mouse
+
+  Uses the same bit-per-clock-edge receiver as the keyboard, plus the
+  host-to-device direction needed to set the mouse up.  Only built when
+  the USB type includes a mouse (MOUSE_INTERFACE).  Packets are
+  decoded in the interrupt and their motion is added up, so nothing is
+  lost while loop() is busy; update() turns whatever has collected into
+  at most one USB report per millisecond.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef PS2Mouse_h
+#define PS2Mouse_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "int_pins.h"
+
+#ifdef MOUSE_INTERFACE
+
+#define PS2_MOUSE_SAMPLE_RATE 200
+
+typedef struct {
+	uint32_t packets;
+	uint32_t frame_errors;
+	uint32_t resyncs;	// bytes thrown away to find the packet start again
+	uint32_t overflows;	// packets with the overflow bit, motion ignored
+	uint32_t reports;	// USB mouse reports sent
+	uint32_t latency_max_us;	// oldest packet in a report to the report
+	uint32_t latency_avg_us;
+} PS2MouseStats_t;
+
+class PS2Mouse {
+  public:
+    /**
+     * Resets the mouse, turns on the wheel if it has one, sets the sample
+     * rate and starts streaming.  Takes up to about a second, returns
+     * false if no mouse answered.
+     */
+    static bool begin(uint8_t dataPin, uint8_t irq_pin);
+
+    /**
+     * True if the mouse reports a wheel (4 byte packets).
+     */
+    static bool hasWheel();
+
+    /**
+     * Sends the motion collected since the last report, if any.  Call it
+     * from loop() as often as possible.
+     */
+    static void update();
+
+    /**
+     * True while motion or buttons wait for a report.
+     */
+    static bool pending();
+
+    static void getStats(PS2MouseStats_t *stats);
+};
+
+#if PS2_FRAME_SOURCE == PS2_FRAME_SOURCE_SIM
+// Simulated source only: begin() skips the mouse setup and takes 4 byte
+// packets, fed one byte at a time as if they came off the wire
+void ps2_mouse_sim_byte(uint8_t b);
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,400 @@
+/*
+  degramctl - talks to the Degramatyzer over its raw HID interface
+
+  Build:  g++ -O2 -o degramctl degramctl.cpp
+
+  Usage:  degramctl [-d device] mode [n]
+          degramctl [-d device] stats
+          degramctl [-d device] watch [interval_ms]
+          degramctl [-d device] tourette file|--reset
+          degramctl [-d device] load pattern [rate [ms]]
+
+  Without -d the first /dev/hidraw* whose report descriptor has the raw
+  HID usage page (0xFFAB) is used; reading it usually needs a udev rule
+  or root.  "-d unix:path" connects to a SOCK_SEQPACKET socket instead,
+  which lets a stand-in device exchange the same 64 byte packets:
+  "degramd -c path" runs the firmware's own control endpoint behind one.
+
+  The tourette file has one word per line, letters and digits only, at
+  most 8 per word and 16 words.  They are typed with shift held, so a
+  digit 1 comes out as "!".
+
+  load runs the firmware's load test (PS2LoadGen.h) in every mode, ms
+  each (default 1000) at rate scan codes per second (default 0, as fast
+  as the ring takes them).  The board types the load into whatever has
+  the focus.  Patterns: burst, rollover, repeat, switch, mix.
+
+  Numbers must be whole decimal numbers in range: the mode below the
+  device's mode count, interval_ms 1 to 65535, rate up to
+  MAX_LOAD_RATE and ms 1 to MAX_LOAD_MS.  watch stops the stream again
+  when interrupted.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <linux/hidraw.h>
+
+#include "../../ControlProtocol.h"
+
+#define DICTIONARY_SIZE 16
+#define WORD_SIZE 8
+#define TIMEOUT_MS 1000
+#define MAX_LOAD_RATE 1000000	// scan codes per second
+#define MAX_LOAD_MS 3600000	// per mode
+
+// In PS2LoadGen.h order
+static const char *const pattern_names[] = {
+	"burst", "rollover", "repeat", "switch", "mix"
+};
+#define LOAD_PATTERNS (sizeof(pattern_names) / sizeof(pattern_names[0]))
+
+static int  dev = -1;
+static bool is_hidraw = true;
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
+static long parse_count(const char *s, long min, long max)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (errno || end == s || *end || v < min || v > max) return -1;
+	return v;
+}
+
+static bool has_rawhid_usage(int fd)
+{
+	struct hidraw_report_descriptor desc;
+	int size = 0;
+
+	if (ioctl(fd, HIDIOCGRDESCSIZE, &size) < 0) return false;
+	desc.size = size;
+	if (ioctl(fd, HIDIOCGRDESC, &desc) < 0) return false;
+	for (int i = 0; i + 2 < size; i++) {
+		// Usage Page (0xFFAB), two byte form
+		if (desc.value[i] == 0x06 && desc.value[i + 1] == 0xAB &&
+		    desc.value[i + 2] == 0xFF) return true;
+	}
+	return false;
+}
+
+static int open_device(const char *path)
+{
+	if (path && !strncmp(path, "unix:", 5)) {
+		struct sockaddr_un addr;
+		int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+
+		if (fd < 0) return -1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, path + 5, sizeof(addr.sun_path) - 1);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			close(fd);
+			return -1;
+		}
+		is_hidraw = false;
+		return fd;
+	}
+	if (path) return open(path, O_RDWR);
+
+	glob_t g;
+	int fd = -1;
+
+	if (glob("/dev/hidraw*", 0, NULL, &g) != 0) return -1;
+	for (size_t i = 0; i < g.gl_pathc && fd < 0; i++) {
+		fd = open(g.gl_pathv[i], O_RDWR);
+		if (fd >= 0 && !has_rawhid_usage(fd)) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	globfree(&g);
+	return fd;
+}
+
+static bool send_packet(const uint8_t *packet)
+{
+	uint8_t buf[CTRL_PACKET_SIZE + 1];
+
+	if (!is_hidraw) {
+		return write(dev, packet, CTRL_PACKET_SIZE) == CTRL_PACKET_SIZE;
+	}
+	// hidraw wants the report number first, 0 as the device has none
+	buf[0] = 0;
+	memcpy(buf + 1, packet, CTRL_PACKET_SIZE);
+	return write(dev, buf, sizeof(buf)) == (ssize_t)sizeof(buf);
+}
+
+static bool recv_packet(uint8_t *packet, int timeout_ms)
+{
+	struct pollfd p = { dev, POLLIN, 0 };
+
+	if (poll(&p, 1, timeout_ms) <= 0) return false;
+	return read(dev, packet, CTRL_PACKET_SIZE) == CTRL_PACKET_SIZE;
+}
+
+// Sends a request and waits for the answer to it, skipping any streamed
+// stats packets that arrive in between.
+static bool request(uint8_t *packet)
+{
+	uint8_t cmd = packet[0];
+
+	if (!send_packet(packet)) return false;
+	while (recv_packet(packet, TIMEOUT_MS)) {
+		if (packet[0] == cmd) return true;
+		if (packet[0] == CTRL_ERROR) {
+			fprintf(stderr, "device refused the request\n");
+			return false;
+		}
+	}
+	fprintf(stderr, "no answer from the device\n");
+	return false;
+}
+
+static void print_stats(const uint8_t *packet)
+{
+	uint32_t keys = ctrl_get32(packet, CTRL_STAT_KEYSTROKES);
+
+	printf("interrupts   %u\n", ctrl_get32(packet, CTRL_STAT_INTERRUPTS));
+	printf("frames       %u\n", ctrl_get32(packet, CTRL_STAT_FRAMES));
+	printf("frame errors %u\n", ctrl_get32(packet, CTRL_STAT_FRAME_ERRORS));
+	printf("ring drops   %u\n", ctrl_get32(packet, CTRL_STAT_RING_DROPS));
+	printf("inhibits     %u\n", ctrl_get32(packet, CTRL_STAT_INHIBITS));
+	printf("keystrokes   %u\n", keys);
+	printf("reports      %u\n", ctrl_get32(packet, CTRL_STAT_REPORTS));
+	if (keys) {
+		printf("irq/key      %.1f\n",
+		       (double)ctrl_get32(packet, CTRL_STAT_INTERRUPTS) / keys);
+	}
+	printf("reports/key ");
+	for (int i = 0; i < CTRL_STAT_HISTOGRAM_SIZE; i++) {
+		printf(" %d%s:%u", i, i == CTRL_STAT_HISTOGRAM_SIZE - 1 ? "+" : "",
+		       ctrl_get32(packet, CTRL_STAT_HISTOGRAM + i));
+	}
+	printf("\n");
+}
+
+static uint8_t usb_key(char c)
+{
+	if (c >= 'a' && c <= 'z') return 4 + c - 'a';
+	if (c >= 'A' && c <= 'Z') return 4 + c - 'A';
+	if (c >= '1' && c <= '9') return 30 + c - '1';
+	if (c == '0') return 39;
+	return 0;
+}
+
+static int upload_tourette(const char *file)
+{
+	uint8_t table[DICTIONARY_SIZE * WORD_SIZE];
+	uint8_t packet[CTRL_PACKET_SIZE];
+	char line[256];
+	int word = 0;
+	FILE *f = fopen(file, "r");
+
+	if (!f) {
+		perror(file);
+		return 1;
+	}
+	memset(table, 0, sizeof(table));
+	while (fgets(line, sizeof(line), f)) {
+		int n = 0;
+
+		line[strcspn(line, "\r\n")] = 0;
+		if (!line[0]) continue;
+		if (word == DICTIONARY_SIZE) {
+			fprintf(stderr, "%s: more than %d words\n", file, DICTIONARY_SIZE);
+			fclose(f);
+			return 1;
+		}
+		for (char *p = line; *p; p++) {
+			uint8_t k = usb_key(*p);
+			if (!k || n == WORD_SIZE) {
+				fprintf(stderr, "%s: bad word \"%s\"\n", file, line);
+				fclose(f);
+				return 1;
+			}
+			table[word * WORD_SIZE + n++] = k;
+		}
+		word++;
+	}
+	fclose(f);
+
+	for (int offset = 0; offset < (int)sizeof(table); offset += CTRL_TABLE_CHUNK) {
+		int length = sizeof(table) - offset;
+
+		if (length > CTRL_TABLE_CHUNK) length = CTRL_TABLE_CHUNK;
+		memset(packet, 0, sizeof(packet));
+		packet[0] = CTRL_SET_TABLE;
+		packet[1] = CTRL_TABLE_TOURETTE;
+		packet[2] = offset;
+		packet[3] = length;
+		memcpy(packet + 4, table + offset, length);
+		if (!request(packet)) return 1;
+	}
+	printf("uploaded %d words\n", word);
+	return 0;
+}
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"usage: degramctl [-d device] mode [n]\n"
+		"       degramctl [-d device] stats\n"
+		"       degramctl [-d device] watch [interval_ms]\n"
+		"       degramctl [-d device] tourette file|--reset\n"
+		"       degramctl [-d device] load pattern [rate [ms]]\n");
+	return 2;
+}
+
+static int load_test(uint8_t *packet, const char *pattern, uint32_t rate, uint32_t ms)
+{
+	uint8_t modes = 1;
+
+	for (packet[1] = 0; packet[1] < LOAD_PATTERNS; packet[1]++) {
+		if (!strcmp(pattern, pattern_names[packet[1]])) break;
+	}
+	if (packet[1] == LOAD_PATTERNS) return usage();
+	packet[0] = CTRL_LOAD_TEST;
+	ctrl_put32(packet, CTRL_LOAD_RATE, rate);
+	ctrl_put32(packet, CTRL_LOAD_DURATION, ms);
+	ctrl_put32(packet, CTRL_LOAD_SEED, 1);
+	if (!send_packet(packet)) return 1;
+
+	// a mode can run well past ms while the ring drains
+	for (uint8_t seen = 0; seen < modes; ) {
+		if (!recv_packet(packet, 2 * ms + TIMEOUT_MS)) {
+			fprintf(stderr, "no answer from the device\n");
+			return 1;
+		}
+		if (packet[0] == CTRL_ERROR) {
+			fprintf(stderr, "device refused the request\n");
+			return 1;
+		}
+		if (packet[0] != CTRL_LOAD_TEST) continue;
+		uint32_t elapsed = ctrl_get32(packet, CTRL_LOAD_ELAPSED_US);
+		modes = packet[2];
+		seen++;
+		printf("mode %u: %llu scan codes/s, %u keys, %u reports, %u ring drops, %u inhibits, "
+		       "latency us p50 %u, p90 %u, p99 %u, max %u\n",
+		       packet[1],
+		       elapsed ? (unsigned long long)ctrl_get32(packet, CTRL_LOAD_SCAN_CODES) * 1000000 / elapsed : 0ULL,
+		       ctrl_get32(packet, CTRL_LOAD_KEYS), ctrl_get32(packet, CTRL_LOAD_REPORTS),
+		       ctrl_get32(packet, CTRL_LOAD_RING_DROPS), ctrl_get32(packet, CTRL_LOAD_INHIBITS),
+		       ctrl_get32(packet, CTRL_LOAD_P50_US), ctrl_get32(packet, CTRL_LOAD_P90_US),
+		       ctrl_get32(packet, CTRL_LOAD_P99_US), ctrl_get32(packet, CTRL_LOAD_MAX_US));
+		fflush(stdout);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = NULL;
+	uint8_t packet[CTRL_PACKET_SIZE];
+	int i = 1;
+
+	if (i + 1 < argc && !strcmp(argv[i], "-d")) {
+		path = argv[i + 1];
+		i += 2;
+	}
+	if (i >= argc) return usage();
+	const char *cmd = argv[i++];
+
+	dev = open_device(path);
+	if (dev < 0) {
+		fprintf(stderr, "can't open %s: %s\n", path ? path : "a raw HID device",
+			errno ? strerror(errno) : "none found");
+		return 1;
+	}
+	memset(packet, 0, sizeof(packet));
+
+	if (!strcmp(cmd, "mode")) {
+		packet[0] = CTRL_GET_MODE;
+		if (!request(packet)) return 1;
+		if (i < argc) {
+			long n = parse_count(argv[i], 0, packet[2] - 1);
+
+			if (n < 0) {
+				fprintf(stderr, "mode must be 0 to %d\n", packet[2] - 1);
+				return 2;
+			}
+			memset(packet, 0, sizeof(packet));
+			packet[0] = CTRL_SET_MODE;
+			packet[1] = n;
+			if (!request(packet)) return 1;
+		}
+		printf("mode %d of %d\n", packet[1], packet[2]);
+	} else if (!strcmp(cmd, "stats")) {
+		packet[0] = CTRL_GET_STATS;
+		if (!request(packet)) return 1;
+		print_stats(packet);
+	} else if (!strcmp(cmd, "watch")) {
+		long interval = i < argc ? parse_count(argv[i], 1, 0xFFFF) : 1000;
+		struct sigaction sa;
+
+		if (interval < 0) return usage();
+		// no SA_RESTART: the signal ends the poll in recv_packet()
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = on_signal;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		packet[0] = CTRL_STREAM;
+		packet[1] = interval;
+		packet[2] = interval >> 8;
+		if (!request(packet)) return 1;
+		while (!interrupted && recv_packet(packet, interval + TIMEOUT_MS)) {
+			if (packet[0] != CTRL_GET_STATS) continue;
+			print_stats(packet);
+			printf("\n");
+			fflush(stdout);
+		}
+		if (interrupted) {
+			// interval 0 stops the stream, or the device keeps sending
+			memset(packet, 0, sizeof(packet));
+			packet[0] = CTRL_STREAM;
+			return request(packet) ? 0 : 1;
+		}
+		fprintf(stderr, "stream stopped\n");
+		return 1;
+	} else if (!strcmp(cmd, "tourette")) {
+		if (i >= argc) return usage();
+		if (!strcmp(argv[i], "--reset")) {
+			packet[0] = CTRL_RESET_TABLE;
+			packet[1] = CTRL_TABLE_TOURETTE;
+			return request(packet) ? 0 : 1;
+		}
+		return upload_tourette(argv[i]);
+	} else if (!strcmp(cmd, "load")) {
+		if (i >= argc) return usage();
+		long rate = i + 1 < argc ? parse_count(argv[i + 1], 0, MAX_LOAD_RATE) : 0;
+		long ms = i + 2 < argc ? parse_count(argv[i + 2], 1, MAX_LOAD_MS) : 1000;
+
+		if (rate < 0 || ms < 0) return usage();
+		return load_test(packet, argv[i], rate, ms);
+	} else {
+		return usage();
+	}
+	return 0;
+}
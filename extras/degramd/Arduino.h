@@ -0,0 +1,193 @@
+/*
+  Arduino.h - just enough of the Teensy core to build the keyboard
+  pipeline on Linux
+
+  PS2Keyboard_2.cpp, PS2FrameSource.cpp, HIDTyper.cpp, PS2Control.cpp
+  and PS2Mouse.cpp are compiled unchanged against this header, with
+  PS2_FRAME_SOURCE_SIM.  Pins and interrupts do nothing, time comes from
+  host_now_us(), Keyboard and Mouse hand every report they send to
+  host_report() and host_mouse_report(), and RawHID moves packets
+  through host_control_recv() and host_control_send() (see host.h).
+
+  Only <stdint.h>, <stddef.h> and <string.h> are pulled in, so that
+  random() is the Arduino one and not the one from <stdlib.h>.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define FALLING 2
+#define CORE_INT_EVERY_PIN
+
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+uint8_t digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t irq, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t irq);
+static inline void noInterrupts(void) {}
+static inline void interrupts(void) {}
+long random(long min, long max);
+
+// The Teensy keyboard, minus media keys and the print interface
+class usb_keyboard_class {
+  public:
+    void set_modifier(uint16_t c) { report[0] = (uint8_t)c; }
+    void set_key1(uint8_t c) { report[2] = c; }
+    void set_key2(uint8_t c) { report[3] = c; }
+    void set_key3(uint8_t c) { report[4] = c; }
+    void set_key4(uint8_t c) { report[5] = c; }
+    void set_key5(uint8_t c) { report[6] = c; }
+    void set_key6(uint8_t c) { report[7] = c; }
+    void send_now(void);
+    void press(uint16_t key);
+    void release(uint16_t key);
+  private:
+    uint8_t report[8];
+};
+
+extern usb_keyboard_class Keyboard;
+
+// The mouse, as the Teensy 3.x core has it: move() sends the buttons
+// kept in usb_mouse_buttons_state
+#define MOUSE_INTERFACE
+#define CORE_MOUSE_BUTTONS_STATE
+extern uint8_t usb_mouse_buttons_state;
+
+class usb_mouse_class {
+  public:
+    void move(int8_t x, int8_t y, int8_t wheel = 0);
+    void set_buttons(uint8_t left, uint8_t middle = 0, uint8_t right = 0);
+};
+
+extern usb_mouse_class Mouse;
+
+// The raw HID interface, as the Teensy core has it with a RawHID USB type
+#define RAWHID_INTERFACE
+class usb_rawhid_class {
+  public:
+    int recv(void *buffer, uint16_t timeout);
+    int send(const void *buffer, uint16_t timeout);
+};
+
+extern usb_rawhid_class RawHID;
+
+// Key codes as in the Teensy keylayouts.h: USB usage, flags on top
+#define KEY_A			( 4   | 0xF000 )
+#define KEY_B			( 5   | 0xF000 )
+#define KEY_C			( 6   | 0xF000 )
+#define KEY_D			( 7   | 0xF000 )
+#define KEY_E			( 8   | 0xF000 )
+#define KEY_F			( 9   | 0xF000 )
+#define KEY_G			( 10  | 0xF000 )
+#define KEY_H			( 11  | 0xF000 )
+#define KEY_I			( 12  | 0xF000 )
+#define KEY_J			( 13  | 0xF000 )
+#define KEY_K			( 14  | 0xF000 )
+#define KEY_L			( 15  | 0xF000 )
+#define KEY_M			( 16  | 0xF000 )
+#define KEY_N			( 17  | 0xF000 )
+#define KEY_O			( 18  | 0xF000 )
+#define KEY_P			( 19  | 0xF000 )
+#define KEY_Q			( 20  | 0xF000 )
+#define KEY_R			( 21  | 0xF000 )
+#define KEY_S			( 22  | 0xF000 )
+#define KEY_T			( 23  | 0xF000 )
+#define KEY_U			( 24  | 0xF000 )
+#define KEY_V			( 25  | 0xF000 )
+#define KEY_W			( 26  | 0xF000 )
+#define KEY_X			( 27  | 0xF000 )
+#define KEY_Y			( 28  | 0xF000 )
+#define KEY_Z			( 29  | 0xF000 )
+#define KEY_1			( 30  | 0xF000 )
+#define KEY_2			( 31  | 0xF000 )
+#define KEY_3			( 32  | 0xF000 )
+#define KEY_4			( 33  | 0xF000 )
+#define KEY_5			( 34  | 0xF000 )
+#define KEY_6			( 35  | 0xF000 )
+#define KEY_7			( 36  | 0xF000 )
+#define KEY_8			( 37  | 0xF000 )
+#define KEY_9			( 38  | 0xF000 )
+#define KEY_0			( 39  | 0xF000 )
+#define KEY_ENTER		( 40  | 0xF000 )
+#define KEY_ESC			( 41  | 0xF000 )
+#define KEY_BACKSPACE		( 42  | 0xF000 )
+#define KEY_TAB			( 43  | 0xF000 )
+#define KEY_SPACE		( 44  | 0xF000 )
+#define KEY_MINUS		( 45  | 0xF000 )
+#define KEY_EQUAL		( 46  | 0xF000 )
+#define KEY_LEFT_BRACE		( 47  | 0xF000 )
+#define KEY_RIGHT_BRACE		( 48  | 0xF000 )
+#define KEY_BACKSLASH		( 49  | 0xF000 )
+#define KEY_SEMICOLON		( 51  | 0xF000 )
+#define KEY_QUOTE		( 52  | 0xF000 )
+#define KEY_TILDE		( 53  | 0xF000 )
+#define KEY_COMMA		( 54  | 0xF000 )
+#define KEY_PERIOD		( 55  | 0xF000 )
+#define KEY_SLASH		( 56  | 0xF000 )
+#define KEY_CAPS_LOCK		( 57  | 0xF000 )
+#define KEY_F1			( 58  | 0xF000 )
+#define KEY_F2			( 59  | 0xF000 )
+#define KEY_F3			( 60  | 0xF000 )
+#define KEY_F4			( 61  | 0xF000 )
+#define KEY_F5			( 62  | 0xF000 )
+#define KEY_F6			( 63  | 0xF000 )
+#define KEY_F7			( 64  | 0xF000 )
+#define KEY_F8			( 65  | 0xF000 )
+#define KEY_F9			( 66  | 0xF000 )
+#define KEY_F10			( 67  | 0xF000 )
+#define KEY_F11			( 68  | 0xF000 )
+#define KEY_F12			( 69  | 0xF000 )
+#define KEY_PRINTSCREEN		( 70  | 0xF000 )
+#define KEY_SCROLL_LOCK		( 71  | 0xF000 )
+#define KEY_PAUSE		( 72  | 0xF000 )
+#define KEY_INSERT		( 73  | 0xF000 )
+#define KEY_HOME		( 74  | 0xF000 )
+#define KEY_PAGE_UP		( 75  | 0xF000 )
+#define KEY_DELETE		( 76  | 0xF000 )
+#define KEY_END			( 77  | 0xF000 )
+#define KEY_PAGE_DOWN		( 78  | 0xF000 )
+#define KEY_RIGHT		( 79  | 0xF000 )
+#define KEY_LEFT		( 80  | 0xF000 )
+#define KEY_DOWN		( 81  | 0xF000 )
+#define KEY_UP			( 82  | 0xF000 )
+#define KEY_NUM_LOCK		( 83  | 0xF000 )
+#define KEYPAD_SLASH		( 84  | 0xF000 )
+#define KEYPAD_ASTERIX		( 85  | 0xF000 )
+#define KEYPAD_MINUS		( 86  | 0xF000 )
+#define KEYPAD_PLUS		( 87  | 0xF000 )
+#define KEYPAD_ENTER		( 88  | 0xF000 )
+#define KEYPAD_1		( 89  | 0xF000 )
+#define KEYPAD_2		( 90  | 0xF000 )
+#define KEYPAD_3		( 91  | 0xF000 )
+#define KEYPAD_4		( 92  | 0xF000 )
+#define KEYPAD_5		( 93  | 0xF000 )
+#define KEYPAD_6		( 94  | 0xF000 )
+#define KEYPAD_7		( 95  | 0xF000 )
+#define KEYPAD_8		( 96  | 0xF000 )
+#define KEYPAD_9		( 97  | 0xF000 )
+#define KEYPAD_0		( 98  | 0xF000 )
+#define KEYPAD_PERIOD		( 99  | 0xF000 )
+
+#endif
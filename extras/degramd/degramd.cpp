@@ -0,0 +1,758 @@
+/*
+  degramd - runs the Degramatyzer's keyboard pipeline on Linux
+
+  Build:  g++ -O2 -DARDUINO=105 -DPS2_FRAME_SOURCE=PS2_FRAME_SOURCE_SIM -I. -o degramd \
+              degramd.cpp host_core.cpp ../../PS2Keyboard_2.cpp \
+              ../../PS2FrameSource.cpp ../../HIDTyper.cpp ../../PS2LoadGen.cpp \
+              ../../PS2Control.cpp ../../PS2Mouse.cpp
+
+  Usage:  degramd [-m mode] [-g] [-s seconds] [-c socket] -i input -o output
+          degramd -l pattern [-r rate] [-t ms] [-x] [-o output]
+
+  Key events from `input` are turned into the PS/2 scan codes the
+  keyboard would have sent, run through the firmware's own decode, mode
+  and HID typer code, and the USB reports that come out are turned back
+  into key events on `output`.  The volume keys step the mode, as on the
+  board.  Mouse motion, wheel and the three buttons go the same way
+  through the firmware's mouse relay, as 4 byte IntelliMouse packets
+  (one per SYN_REPORT) in and USB mouse reports out.
+
+  input   an evdev device (/dev/input/eventN, -g grabs it so its keys
+          only arrive through degramd), a FIFO, or a file of recorded
+          struct input_event (cat /dev/input/eventN > keys.ev)
+  output  /dev/uinput, which gets a virtual keyboard, or any other path,
+          which gets the events as struct input_event records
+
+  Statistics go to stderr every -s seconds (up to MAX_STATS_S, 0 for
+  none) and at exit: key events in, reports out, events per second, and
+  the event to output latency.  For an evdev device the latency counts
+  from the kernel's timestamp of the event, otherwise from when read()
+  returned it.  The mouse gets its own line, its latency runs from the
+  oldest packet not yet reported to the report that carries it, which
+  includes the firmware's one report per ms pacing.
+
+  Input is read in batches of IN_BATCH events and output is written in
+  one write() per batch; nothing is allocated per event.
+
+  -c listens on a SOCK_SEQPACKET unix socket at that path and hands the
+  64 byte packets of the connected client to the firmware's own control
+  endpoint (PS2Control.cpp), as the raw HID interface would.  This is
+  the stand-in device for "degramctl -d unix:socket".  One client at a
+  time, a new one replaces the old.  Not served when the input is a
+  regular file, which is run straight through.
+
+  -l runs the firmware's load test (PS2LoadGen.h) instead, in every mode
+  for -t ms (default 1000), at -r scan codes per second (default 0, as
+  fast as the ring takes them); -x keeps injecting while the keyboard
+  is inhibited.  The reports go to -o if given, results to stdout, one
+  line per mode.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "host.h"
+#include "../../PS2LoadGen.h"
+
+#define IN_BATCH	64
+#define OUT_BATCH	1024
+#define REPORT_EVENTS	21	// at most: 8 modifiers, 6 releases, 6 presses, SYN
+#define LATENCY_BUCKETS	4096	// 1 us each, the last one takes the rest
+#define CONTROL_POLL_MS	10	// with a control client, for streamed stats
+#define MOUSE_POLL_MS	1	// while mouse motion waits, the USB poll interval
+#define MAX_STATS_S	86400	// -s
+#define MAX_LOAD_RATE	1000000	// -r, scan codes per second
+#define MAX_LOAD_MS	3600000	// -t, per mode
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+// Linux key code -> PS/2 set 2 make code, 0xE000 for the E0 prefixed ones
+static const uint16_t evdev_to_ps2[128] = {
+	0,      0x76,   0x16,   0x1E,   0x26,   0x25,   0x2E,   0x36,	// -, ESC, 1..6
+	0x3D,   0x3E,   0x46,   0x45,   0x4E,   0x55,   0x66,   0x0D,	// 7..0, - =, BKSP, TAB
+	0x15,   0x1D,   0x24,   0x2D,   0x2C,   0x35,   0x3C,   0x43,	// Q W E R T Y U I
+	0x44,   0x4D,   0x54,   0x5B,   0x5A,   0x14,   0x1C,   0x1B,	// O P [ ] ENTER LCTRL A S
+	0x23,   0x2B,   0x34,   0x33,   0x3B,   0x42,   0x4B,   0x4C,	// D F G H J K L ;
+	0x52,   0x0E,   0x12,   0x5D,   0x1A,   0x22,   0x21,   0x2A,	// ' ` LSHIFT \ Z X C V
+	0x32,   0x31,   0x3A,   0x41,   0x49,   0x4A,   0x59,   0x7C,	// B N M , . / RSHIFT KP*
+	0x11,   0x29,   0x58,   0x05,   0x06,   0x04,   0x0C,   0x03,	// LALT SPACE CAPS F1..F5
+	0x0B,   0x83,   0x0A,   0x01,   0x09,   0x77,   0x7E,   0x6C,	// F6..F10 NUM SCROLL KP7
+	0x75,   0x7D,   0x7B,   0x6B,   0x73,   0x74,   0x79,   0x69,	// KP8 KP9 KP- KP4..6 KP+ KP1
+	0x72,   0x7A,   0x70,   0x71,   0,      0,      0x61,   0x78,	// KP2 KP3 KP0 KP. - - 102ND F11
+	0x07,   0,      0,      0,      0,      0,      0,      0,	// F12
+	0xE05A, 0xE014, 0xE04A, 0,      0xE011, 0,      0xE06C, 0xE075,	// KPENTER RCTRL KP/ - RALT - HOME UP
+	0xE07D, 0xE06B, 0xE074, 0xE069, 0xE072, 0xE07A, 0xE070, 0xE071,	// PGUP LEFT RIGHT END DOWN PGDN INS DEL
+	0,      0xE023, 0xE021, 0xE032, 0,      0,      0,      0,	// - MUTE VOLDOWN VOLUP
+	0,      0,      0,      0,      0,      0xE01F, 0xE027, 0xE02F	// LMETA RMETA COMPOSE
+};
+
+// USB usage -> Linux key code, as drivers/hid/hid-input.c has it
+static const uint8_t usb_to_evdev[0x66] = {
+	  0,  0,  0,  0, 30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38,
+	 50, 49, 24, 25, 16, 19, 31, 20, 22, 47, 17, 45, 21, 44,  2,  3,
+	  4,  5,  6,  7,  8,  9, 10, 11, 28,  1, 14, 15, 57, 12, 13, 26,
+	 27, 43, 43, 39, 40, 41, 51, 52, 53, 58, 59, 60, 61, 62, 63, 64,
+	 65, 66, 67, 68, 87, 88, 99, 70,119,110,102,104,111,107,109,106,
+	105,108,103, 69, 98, 55, 74, 78, 96, 79, 80, 81, 75, 76, 77, 71,
+	 72, 73, 82, 83, 86,127
+};
+
+// Report modifier bits -> Linux key code
+static const uint16_t modifier_to_evdev[8] = {
+	KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+	KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA
+};
+
+static const char *const mode_names[] = {
+	"none", "degramatyzer", "hodor", "reverse", "tourette"
+};
+
+static int out_fd = -1;
+static bool out_uinput = false;
+static struct input_event out_events[OUT_BATCH];
+static unsigned out_count;
+static uint8_t last_report[HOST_REPORT_SIZE];
+
+static uint64_t pending_start[IN_BATCH];	// per key event of the batch
+static unsigned pending_count;
+
+static uint64_t key_events, reports_out;
+static uint64_t busy_us, started_us;
+static uint32_t latency_hist[LATENCY_BUCKETS];
+static uint64_t latency_max;
+
+static int ctrl_fd = -1;
+static uint8_t ctrl_packet[HOST_PACKET_SIZE];
+static bool ctrl_pending;
+
+// mouse input since the last SYN_REPORT, PS/2 directions
+static int32_t mouse_x, mouse_y, mouse_wheel;
+static uint8_t mouse_buttons, mouse_sent_buttons;
+static bool mouse_dirty;
+// oldest packet the firmware has not reported yet
+static bool mouse_waiting;
+static uint64_t mouse_start;
+static uint64_t mouse_packets, mouse_reports;
+static uint32_t mouse_hist[LATENCY_BUCKETS];
+static uint64_t mouse_latency_max;
+static uint8_t mouse_last_buttons;	// as last reported
+static bool mouse_more;	// motion left for the next USB poll
+
+
+uint64_t host_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void fatal(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void write_all(int fd, const void *data, size_t len)
+{
+	const char *p = (const char *)data;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			fatal("write");
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+static void put_event(uint16_t type, uint16_t code, int32_t value, uint64_t now)
+{
+	struct input_event *ev = &out_events[out_count++];
+
+	ev->input_event_sec = now / 1000000;
+	ev->input_event_usec = now % 1000000;
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+}
+
+static void record_latency(uint32_t *hist, uint64_t *max, uint64_t us)
+{
+	if (us > *max) *max = us;
+	hist[us < LATENCY_BUCKETS ? us : LATENCY_BUCKETS - 1]++;
+}
+
+static void flush_output(void)
+{
+	uint64_t now;
+
+	if (out_count) write_all(out_fd, out_events, out_count * sizeof(out_events[0]));
+	out_count = 0;
+
+	now = host_now_us();
+	for (unsigned i = 0; i < pending_count; i++) {
+		uint64_t us = now > pending_start[i] ? now - pending_start[i] : 0;
+		record_latency(latency_hist, &latency_max, us);
+	}
+	pending_count = 0;
+}
+
+static bool report_has(const uint8_t *report, uint8_t key)
+{
+	for (int i = 2; i < HOST_REPORT_SIZE; i++) {
+		if (report[i] == key) return true;
+	}
+	return false;
+}
+
+static uint16_t evdev_key(uint8_t usage)
+{
+	return usage < sizeof(usb_to_evdev) ? usb_to_evdev[usage] : 0;
+}
+
+bool host_control_recv(uint8_t *packet)
+{
+	if (!ctrl_pending) return false;
+	memcpy(packet, ctrl_packet, HOST_PACKET_SIZE);
+	ctrl_pending = false;
+	return true;
+}
+
+// Like the firmware's zero timeout sends: a client that is not reading
+// loses the packet
+void host_control_send(const uint8_t *packet)
+{
+	if (ctrl_fd >= 0) send(ctrl_fd, packet, HOST_PACKET_SIZE, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// Releases first, then presses, like the kernel's HID driver
+void host_report(const uint8_t *report)
+{
+	uint64_t now = host_now_us();
+	uint8_t changed = report[0] ^ last_report[0];
+	int i;
+
+	if (out_count + REPORT_EVENTS > OUT_BATCH) {
+		write_all(out_fd, out_events, out_count * sizeof(out_events[0]));
+		out_count = 0;
+	}
+	for (i = 0; i < 8; i++) {
+		if ((changed & ~report[0]) & (1 << i)) put_event(EV_KEY, modifier_to_evdev[i], 0, now);
+	}
+	for (i = 2; i < HOST_REPORT_SIZE; i++) {
+		uint8_t k = last_report[i];
+		if (k && !report_has(report, k) && evdev_key(k)) put_event(EV_KEY, evdev_key(k), 0, now);
+	}
+	for (i = 0; i < 8; i++) {
+		if ((changed & report[0]) & (1 << i)) put_event(EV_KEY, modifier_to_evdev[i], 1, now);
+	}
+	for (i = 2; i < HOST_REPORT_SIZE; i++) {
+		uint8_t k = report[i];
+		if (k && !report_has(last_report, k) && evdev_key(k)) put_event(EV_KEY, evdev_key(k), 1, now);
+	}
+	put_event(EV_SYN, SYN_REPORT, 0, now);
+	memcpy(last_report, report, HOST_REPORT_SIZE);
+	reports_out++;
+}
+
+void host_mouse_report(uint8_t buttons, int8_t x, int8_t y, int8_t wheel)
+{
+	static const uint16_t button_codes[3] = { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE };
+	uint64_t now = host_now_us();
+	uint8_t changed = buttons ^ mouse_last_buttons;
+
+	if (out_count + REPORT_EVENTS > OUT_BATCH) {
+		write_all(out_fd, out_events, out_count * sizeof(out_events[0]));
+		out_count = 0;
+	}
+	for (int i = 0; i < 3; i++) {
+		if (changed & (1 << i)) put_event(EV_KEY, button_codes[i], (buttons >> i) & 1, now);
+	}
+	if (x) put_event(EV_REL, REL_X, x, now);
+	if (y) put_event(EV_REL, REL_Y, y, now);
+	if (wheel) put_event(EV_REL, REL_WHEEL, wheel, now);
+	put_event(EV_SYN, SYN_REPORT, 0, now);
+	mouse_last_buttons = buttons;
+	mouse_reports++;
+	if (mouse_waiting) {
+		record_latency(mouse_hist, &mouse_latency_max, now > mouse_start ? now - mouse_start : 0);
+		mouse_waiting = false;
+	}
+}
+
+static int32_t clamp(int32_t v, int32_t limit)
+{
+	return v > limit ? limit : v < -limit ? -limit : v;
+}
+
+// Splits what came since the last SYN_REPORT into PS/2 packets, each
+// within the 9 bit X/Y and 8 bit wheel range
+static void mouse_sync(uint64_t start)
+{
+	if (!mouse_dirty) return;
+	do {
+		int32_t x = clamp(mouse_x, 255), y = clamp(mouse_y, 255);
+		int32_t w = clamp(mouse_wheel, 127);
+		uint8_t packet[4] = {
+			(uint8_t)(0x08 | mouse_buttons | (x < 0 ? 0x10 : 0) | (y < 0 ? 0x20 : 0)),
+			(uint8_t)x, (uint8_t)y, (uint8_t)w
+		};
+
+		mouse_x -= x;
+		mouse_y -= y;
+		mouse_wheel -= w;
+		if (!mouse_waiting) {
+			mouse_waiting = true;
+			mouse_start = start;
+		}
+		mouse_packets++;
+		host_mouse_bytes(packet, sizeof(packet));
+	} while (mouse_x || mouse_y || mouse_wheel);
+	mouse_sent_buttons = mouse_buttons;
+	mouse_dirty = false;
+}
+
+// Returns true if it was a mouse event
+static bool mouse_event(const struct input_event *ev, uint64_t start)
+{
+	uint8_t bit;
+
+	if (ev->type == EV_REL) {
+		if (ev->code == REL_X) mouse_x += ev->value;
+		else if (ev->code == REL_Y) mouse_y -= ev->value;	// PS/2 Y is up
+		else if (ev->code == REL_WHEEL) mouse_wheel -= ev->value;	// and the wheel down
+		else return true;
+		mouse_dirty = true;
+		return true;
+	}
+	if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+		mouse_sync(start);
+		return true;
+	}
+	if (ev->type != EV_KEY) return false;
+	if (ev->code == BTN_LEFT) bit = 0x01;
+	else if (ev->code == BTN_RIGHT) bit = 0x02;
+	else if (ev->code == BTN_MIDDLE) bit = 0x04;
+	else return false;
+	if (ev->value) mouse_buttons |= bit;
+	else mouse_buttons &= ~bit;
+	mouse_dirty = mouse_buttons != mouse_sent_buttons || mouse_x || mouse_y || mouse_wheel;
+	return true;
+}
+
+// Press (1), repeat (2) and release (0) as the keyboard sends them
+static void key_event(uint16_t code, int32_t value)
+{
+	uint8_t codes[3];
+	uint8_t n = 0;
+	uint16_t ps2;
+
+	if (code >= sizeof(evdev_to_ps2) / sizeof(evdev_to_ps2[0])) return;
+	ps2 = evdev_to_ps2[code];
+	if (!ps2) return;
+	if (ps2 & 0xE000) codes[n++] = 0xE0;
+	if (value == 0) codes[n++] = 0xF0;
+	codes[n++] = ps2 & 0xFF;
+	host_scan_codes(codes, n);
+}
+
+static void process(const struct input_event *events, unsigned count,
+		    uint64_t read_us, bool event_time)
+{
+	for (unsigned i = 0; i < count; i++) {
+		const struct input_event *ev = &events[i];
+		uint64_t start = event_time ?
+			(uint64_t)ev->input_event_sec * 1000000 + ev->input_event_usec : read_us;
+
+		if (mouse_event(ev, start)) continue;
+		if (ev->type != EV_KEY) continue;
+		key_events++;
+		pending_start[pending_count++] = start;
+		key_event(ev->code, ev->value);
+	}
+	mouse_more = host_mouse_update();
+	flush_output();
+}
+
+static uint64_t percentile(const uint32_t *hist, uint64_t total, double p)
+{
+	uint64_t want = (uint64_t)(total * p), seen = 0;
+
+	for (unsigned i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen > want) return i;
+	}
+	return LATENCY_BUCKETS - 1;
+}
+
+static void report_stats(void)
+{
+	uint64_t elapsed = host_now_us() - started_us;
+	uint64_t total = 0, mouse_total = 0;
+
+	for (unsigned i = 0; i < LATENCY_BUCKETS; i++) {
+		total += latency_hist[i];
+		mouse_total += mouse_hist[i];
+	}
+	fprintf(stderr, "%s: %llu key events, %llu reports, %.0f events/s "
+		"(%.0f/s while busy), %u ring drops\n",
+		mode_names[host_mode()],
+		(unsigned long long)key_events, (unsigned long long)reports_out,
+		elapsed ? key_events * 1e6 / elapsed : 0.0,
+		busy_us ? key_events * 1e6 / busy_us : 0.0,
+		host_ring_drops());
+	if (total) {
+		fprintf(stderr, "latency us: p50 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+			(unsigned long long)percentile(latency_hist, total, 0.5),
+			(unsigned long long)percentile(latency_hist, total, 0.99),
+			(unsigned long long)percentile(latency_hist, total, 0.999),
+			(unsigned long long)latency_max);
+	}
+	if (mouse_total) {
+		fprintf(stderr, "mouse: %llu packets, %llu reports, "
+			"latency us: p50 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+			(unsigned long long)mouse_packets, (unsigned long long)mouse_reports,
+			(unsigned long long)percentile(mouse_hist, mouse_total, 0.5),
+			(unsigned long long)percentile(mouse_hist, mouse_total, 0.99),
+			(unsigned long long)percentile(mouse_hist, mouse_total, 0.999),
+			(unsigned long long)mouse_latency_max);
+	}
+}
+
+// Reads one batch.  Returns false at end of input.
+static bool read_batch(int fd, bool event_time)
+{
+	static union {
+		struct input_event events[IN_BATCH];
+		char bytes[IN_BATCH * sizeof(struct input_event)];
+	} in;
+	static size_t have;	// bytes, a pipe can end a read inside a record
+	ssize_t n;
+
+	n = read(fd, in.bytes + have, sizeof(in.bytes) - have);
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN) return true;
+		fatal("read");
+	}
+	if (n == 0) return false;
+
+	uint64_t start = host_now_us();
+	unsigned count;
+
+	have += n;
+	count = have / sizeof(struct input_event);
+	process(in.events, count, start, event_time);
+	have -= count * sizeof(struct input_event);
+	memmove(in.bytes, in.bytes + count * sizeof(struct input_event), have);
+	busy_us += host_now_us() - start;
+	return true;
+}
+
+static void open_uinput(const char *path)
+{
+	struct uinput_setup setup;
+	unsigned i;
+
+	out_fd = open(path, O_WRONLY | O_NONBLOCK);
+	if (out_fd < 0) fatal(path);
+	if (ioctl(out_fd, UI_SET_EVBIT, EV_KEY) < 0) fatal("UI_SET_EVBIT");
+	ioctl(out_fd, UI_SET_EVBIT, EV_SYN);
+	for (i = 0; i < sizeof(usb_to_evdev); i++) {
+		if (usb_to_evdev[i]) ioctl(out_fd, UI_SET_KEYBIT, usb_to_evdev[i]);
+	}
+	for (i = 0; i < 8; i++) ioctl(out_fd, UI_SET_KEYBIT, modifier_to_evdev[i]);
+	ioctl(out_fd, UI_SET_KEYBIT, BTN_LEFT);
+	ioctl(out_fd, UI_SET_KEYBIT, BTN_RIGHT);
+	ioctl(out_fd, UI_SET_KEYBIT, BTN_MIDDLE);
+	ioctl(out_fd, UI_SET_EVBIT, EV_REL);
+	ioctl(out_fd, UI_SET_RELBIT, REL_X);
+	ioctl(out_fd, UI_SET_RELBIT, REL_Y);
+	ioctl(out_fd, UI_SET_RELBIT, REL_WHEEL);
+
+	memset(&setup, 0, sizeof(setup));
+	setup.id.bustype = BUS_USB;
+	setup.id.vendor = 0x16C0;	// the Teensy keyboard's ids
+	setup.id.product = 0x04D0;
+	strcpy(setup.name, "Degramatyzer");
+	if (ioctl(out_fd, UI_DEV_SETUP, &setup) < 0) fatal("UI_DEV_SETUP");
+	if (ioctl(out_fd, UI_DEV_CREATE) < 0) fatal("UI_DEV_CREATE");
+	out_uinput = true;
+}
+
+static void open_output(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) == 0 && S_ISCHR(st.st_mode)) {
+		open_uinput(path);
+		return;
+	}
+	out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) fatal(path);
+}
+
+// Returns true if the events carry usable CLOCK_MONOTONIC timestamps
+static bool setup_evdev(int fd, bool grab)
+{
+	int clock = CLOCK_MONOTONIC;
+
+	if (grab && ioctl(fd, EVIOCGRAB, 1) < 0) fatal("EVIOCGRAB");
+	return ioctl(fd, EVIOCSCLOCKID, &clock) == 0;
+}
+
+static int listen_control(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+
+	if (fd < 0) fatal("socket");
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) fatal(path);
+	if (listen(fd, 1) < 0) fatal("listen");
+	return fd;
+}
+
+// Returns false when the client has gone
+static bool read_control(void)
+{
+	ssize_t n = recv(ctrl_fd, ctrl_packet, sizeof(ctrl_packet), MSG_DONTWAIT);
+
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) return false;
+	if (n == HOST_PACKET_SIZE) {
+		ctrl_pending = true;
+		host_control_poll();
+	}
+	return true;
+}
+
+static long parse_count(const char *s, long min, long max)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (errno || end == s || *end || v < min || v > max) return -1;
+	return v;
+}
+
+static int parse_mode(const char *s)
+{
+	char *end;
+	long m = strtol(s, &end, 10);
+
+	if (*s && !*end) return m >= 0 && m < host_mode_count() ? m : -1;
+	for (unsigned i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++) {
+		if (!strcmp(s, mode_names[i])) return i;
+	}
+	return -1;
+}
+
+static const char *const pattern_names[LOAD_PATTERNS] = {
+	"burst", "rollover", "repeat", "switch", "mix"
+};
+
+static int parse_pattern(const char *s)
+{
+	for (unsigned i = 0; i < LOAD_PATTERNS; i++) {
+		if (!strcmp(s, pattern_names[i])) return i;
+	}
+	return -1;
+}
+
+static int load_test(const PS2LoadConfig_t *config, const char *out_path)
+{
+	PS2LoadResult_t r;
+
+	if (out_path) {
+		open_output(out_path);
+	} else {
+		out_fd = open("/dev/null", O_WRONLY);
+		if (out_fd < 0) fatal("/dev/null");
+	}
+	host_begin(0);
+	printf("load test, pattern %s, rate %u/s, %u ms per mode\n",
+	       pattern_names[config->pattern], config->rate, config->duration_ms);
+	for (uint8_t m = 0; m < host_mode_count(); m++) {
+		ps2_load_test(config, m, &r);
+		flush_output();
+		printf("%s: %llu scan codes/s, %u keys, %u reports, %u ring drops, %u inhibits, "
+		       "latency us p50 %u, p90 %u, p99 %u, max %u\n",
+		       mode_names[m],
+		       r.elapsed_us ? (unsigned long long)r.scan_codes * 1000000 / r.elapsed_us : 0ULL,
+		       r.keys, r.reports, r.ring_drops, r.inhibits,
+		       r.latency_p50_us, r.latency_p90_us, r.latency_p99_us, r.latency_max_us);
+	}
+	if (out_uinput) ioctl(out_fd, UI_DEV_DESTROY);
+	return 0;
+}
+
+static int usage(void)
+{
+	fprintf(stderr, "usage: degramd [-m mode] [-g] [-s seconds] [-c socket] -i input -o output\n"
+			"       degramd -l pattern [-r rate] [-t ms] [-x] [-o output]\n"
+			"modes: 0-4 or none, degramatyzer, hodor, reverse, tourette\n"
+			"patterns: burst, rollover, repeat, switch, mix\n");
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	const char *in_path = NULL, *out_path = NULL, *ctrl_path = NULL;
+	int mode = 1, opt;
+	long stats_s = 0, n;
+	bool grab = false, event_time = false;
+	struct stat st;
+	int in_fd, pattern = -1;
+	PS2LoadConfig_t load = { LOAD_MIX, 0, 0, 1000, 1 };
+
+	while ((opt = getopt(argc, argv, "m:gs:c:i:o:l:r:t:x")) != -1) {
+		switch (opt) {
+		case 'm': mode = parse_mode(optarg); if (mode < 0) return usage(); break;
+		case 'g': grab = true; break;
+		case 's': stats_s = parse_count(optarg, 0, MAX_STATS_S); if (stats_s < 0) return usage(); break;
+		case 'c': ctrl_path = optarg; break;
+		case 'i': in_path = optarg; break;
+		case 'o': out_path = optarg; break;
+		case 'l': pattern = parse_pattern(optarg); if (pattern < 0) return usage(); break;
+		case 'r': n = parse_count(optarg, 0, MAX_LOAD_RATE); if (n < 0) return usage(); load.rate = n; break;
+		case 't': n = parse_count(optarg, 1, MAX_LOAD_MS); if (n < 0) return usage(); load.duration_ms = n; break;
+		case 'x': load.flags |= LOAD_IGNORE_INHIBIT; break;
+		default: return usage();
+		}
+	}
+	if (pattern >= 0) {
+		if (in_path || optind != argc) return usage();
+		load.pattern = pattern;
+		return load_test(&load, out_path);
+	}
+	if (!in_path || !out_path || optind != argc) return usage();
+
+	// a FIFO waits here for its writer
+	in_fd = open(in_path, O_RDONLY);
+	if (in_fd < 0) fatal(in_path);
+	if (fstat(in_fd, &st) < 0) fatal("fstat");
+	if (S_ISCHR(st.st_mode)) event_time = setup_evdev(in_fd, grab);
+	open_output(out_path);
+
+	host_begin(mode);
+	started_us = host_now_us();
+
+	// A regular file is always readable and epoll won't take it
+	if (S_ISREG(st.st_mode)) {
+		while (read_batch(in_fd, false)) ;
+		while (host_mouse_update()) ;
+		flush_output();
+		report_stats();
+		return 0;
+	}
+
+	fcntl(in_fd, F_SETFL, O_NONBLOCK);
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	int sig_fd = signalfd(-1, &mask, SFD_NONBLOCK);
+	int timer_fd = -1, listen_fd = -1;
+	int ep = epoll_create1(0);
+	struct epoll_event ev;
+
+	if (sig_fd < 0 || ep < 0) fatal("epoll");
+	ev.events = EPOLLIN;
+	ev.data.fd = in_fd;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, in_fd, &ev) < 0) fatal("epoll_ctl");
+	ev.data.fd = sig_fd;
+	epoll_ctl(ep, EPOLL_CTL_ADD, sig_fd, &ev);
+	if (stats_s > 0) {
+		struct itimerspec its;
+		memset(&its, 0, sizeof(its));
+		its.it_interval.tv_sec = its.it_value.tv_sec = stats_s;
+		timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (timer_fd < 0 || timerfd_settime(timer_fd, 0, &its, NULL) < 0) fatal("timerfd");
+		ev.data.fd = timer_fd;
+		epoll_ctl(ep, EPOLL_CTL_ADD, timer_fd, &ev);
+	}
+	if (ctrl_path) {
+		listen_fd = listen_control(ctrl_path);
+		ev.data.fd = listen_fd;
+		epoll_ctl(ep, EPOLL_CTL_ADD, listen_fd, &ev);
+	}
+
+	for (bool running = true; running; ) {
+		struct epoll_event ready[5];
+		int n = epoll_wait(ep, ready, 5, mouse_more ? MOUSE_POLL_MS :
+				   ctrl_fd >= 0 ? CONTROL_POLL_MS : -1);
+
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			fatal("epoll_wait");
+		}
+		for (int i = 0; i < n; i++) {
+			int fd = ready[i].data.fd;
+
+			if (fd == in_fd) {
+				if (!read_batch(in_fd, event_time)) running = false;
+			} else if (fd == timer_fd) {
+				uint64_t expirations;
+				if (read(timer_fd, &expirations, sizeof(expirations)) > 0) report_stats();
+			} else if (fd == sig_fd) {
+				running = false;
+			} else if (fd == listen_fd) {
+				int client = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+				if (client < 0) continue;
+				if (ctrl_fd >= 0) close(ctrl_fd);
+				ctrl_fd = client;
+				ev.data.fd = ctrl_fd;
+				epoll_ctl(ep, EPOLL_CTL_ADD, ctrl_fd, &ev);
+			} else if (fd == ctrl_fd) {
+				if (!read_control()) {
+					close(ctrl_fd);
+					ctrl_fd = -1;
+				}
+			}
+		}
+		if (ctrl_fd >= 0) host_control_poll();
+		if (mouse_more) {
+			mouse_more = host_mouse_update();
+			flush_output();
+		}
+	}
+
+	report_stats();
+	if (grab) ioctl(in_fd, EVIOCGRAB, 0);
+	if (out_uinput) ioctl(out_fd, UI_DEV_DESTROY);
+	if (ctrl_path) unlink(ctrl_path);
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+  host.h - the firmware's keyboard pipeline, as seen from a Linux program
+
+  host_core.cpp builds on the Arduino.h stand-in next to it, the program
+  using these functions builds on the Linux headers; the two key code
+  sets (Teensy KEY_* and Linux KEY_*) never meet in one file.
+
+  Scan codes go in through the simulated frame source, exactly as the
+  frame ISR would queue them, and come out as 8 byte USB keyboard
+  reports: modifiers, reserved, six keys.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef host_h
+#define host_h
+
+#include <stdint.h>
+
+#define HOST_REPORT_SIZE 8
+
+void host_begin(uint8_t mode);
+
+// Queues scan codes and runs the pipeline until the ring is empty.
+// Keep count below the ring's high mark (36).
+void host_scan_codes(const uint8_t *codes, uint8_t count);
+
+uint8_t host_mode(void);
+uint8_t host_mode_count(void);
+
+// Feeds mouse bytes (4 byte IntelliMouse packets) to the firmware's
+// mouse and lets it report.  Reports go out at most once per ms, so
+// call host_mouse_update() again while it returns true.
+void host_mouse_bytes(const uint8_t *bytes, uint8_t count);
+bool host_mouse_update(void);
+
+// Frames dropped because the ring was full
+uint32_t host_ring_drops(void);
+
+// Runs the firmware's control endpoint (PS2Control.cpp) once: answers a
+// packet from host_control_recv(), sends due telemetry
+void host_control_poll(void);
+
+// Supplied by the program: called for every report the firmware sends,
+// and the clock behind millis() and micros()
+void host_report(const uint8_t *report);
+uint64_t host_now_us(void);
+
+// Also supplied: called for every USB mouse report, buttons as in the
+// report (bit 0 left, 1 right, 2 middle), Y down and wheel up positive
+void host_mouse_report(uint8_t buttons, int8_t x, int8_t y, int8_t wheel);
+
+// Also supplied by the program: the raw HID packets, HOST_PACKET_SIZE
+// bytes each.  recv returns false when none is waiting.
+#define HOST_PACKET_SIZE 64
+bool host_control_recv(uint8_t *packet);
+void host_control_send(const uint8_t *packet);
+
+#endif
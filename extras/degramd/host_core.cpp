@@ -0,0 +1,186 @@
+/*
+  host_core.cpp - the Teensy core functions the pipeline calls, on Linux
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include "Arduino.h"
+#include "host.h"
+
+#include "../../PS2Keyboard_2.h"
+#include "../../PS2FrameSource.h"
+#include "../../PS2Control.h"
+#include "../../PS2Mouse.h"
+#include "../../ControlProtocol.h"
+
+#if PS2_FRAME_SOURCE != PS2_FRAME_SOURCE_SIM
+#error "build the pipeline with -DPS2_FRAME_SOURCE=PS2_FRAME_SOURCE_SIM"
+#endif
+
+#if HOST_PACKET_SIZE != CTRL_PACKET_SIZE
+#error "host packets do not match the control protocol"
+#endif
+
+usb_keyboard_class Keyboard;
+usb_rawhid_class RawHID;
+usb_mouse_class Mouse;
+uint8_t usb_mouse_buttons_state;
+
+static PS2Keyboard keyboard;
+static PS2Mouse mouse;
+static uint32_t rng = 2463534242u;
+
+uint32_t millis(void)
+{
+	return host_now_us() / 1000;
+}
+
+uint32_t micros(void)
+{
+	return host_now_us();
+}
+
+void delay(uint32_t ms)
+{
+	delayMicroseconds(ms * 1000);
+}
+
+// Nothing in the pipeline waits, this is only here to link
+void delayMicroseconds(uint32_t us)
+{
+	uint64_t start = host_now_us();
+
+	while (host_now_us() - start < us) ;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+void digitalWrite(uint8_t pin, uint8_t val) { (void)pin; (void)val; }
+uint8_t digitalRead(uint8_t pin) { (void)pin; return HIGH; }
+void attachInterrupt(uint8_t irq, void (*isr)(void), int mode) { (void)irq; (void)isr; (void)mode; }
+void detachInterrupt(uint8_t irq) { (void)irq; }
+
+// xorshift32, the tourette mode only needs something that looks random
+long random(long min, long max)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return max > min ? min + (long)(rng % (uint32_t)(max - min)) : min;
+}
+
+void usb_keyboard_class::send_now(void)
+{
+	host_report(report);
+}
+
+// Like the Teensy core: first free slot, or nothing if it is held already
+void usb_keyboard_class::press(uint16_t key)
+{
+	uint8_t k = key & 0xFF;
+	uint8_t i;
+
+	for (i = 2; i < HOST_REPORT_SIZE; i++) {
+		if (report[i] == k) return;
+	}
+	for (i = 2; i < HOST_REPORT_SIZE; i++) {
+		if (report[i] == 0) {
+			report[i] = k;
+			send_now();
+			return;
+		}
+	}
+}
+
+void usb_keyboard_class::release(uint16_t key)
+{
+	uint8_t k = key & 0xFF;
+
+	for (uint8_t i = 2; i < HOST_REPORT_SIZE; i++) {
+		if (report[i] == k) {
+			report[i] = 0;
+			send_now();
+		}
+	}
+}
+
+void usb_mouse_class::move(int8_t x, int8_t y, int8_t wheel)
+{
+	host_mouse_report(usb_mouse_buttons_state, x, y, wheel);
+}
+
+void usb_mouse_class::set_buttons(uint8_t left, uint8_t middle, uint8_t right)
+{
+	usb_mouse_buttons_state = (left ? 1 : 0) | (right ? 2 : 0) | (middle ? 4 : 0);
+	move(0, 0, 0);
+}
+
+// Nothing waits: the program has the packet or it has not
+int usb_rawhid_class::recv(void *buffer, uint16_t timeout)
+{
+	(void)timeout;
+	return host_control_recv((uint8_t *)buffer) ? HOST_PACKET_SIZE : 0;
+}
+
+int usb_rawhid_class::send(const void *buffer, uint16_t timeout)
+{
+	(void)timeout;
+	host_control_send((const uint8_t *)buffer);
+	return HOST_PACKET_SIZE;
+}
+
+void host_begin(uint8_t mode)
+{
+	keyboard.begin(0, 0);
+	keyboard.setMode(mode);
+	mouse.begin(0, 0);
+}
+
+void host_scan_codes(const uint8_t *codes, uint8_t count)
+{
+	for (uint8_t i = 0; i < count; i++) {
+		ps2_sim_scan_code(codes[i]);
+	}
+	while (keyboard.available()) {
+		keyboard.read();
+	}
+}
+
+uint8_t host_mode(void)
+{
+	return keyboard.getMode();
+}
+
+uint8_t host_mode_count(void)
+{
+	return keyboard.modeCount();
+}
+
+void host_mouse_bytes(const uint8_t *bytes, uint8_t count)
+{
+	for (uint8_t i = 0; i < count; i++) {
+		ps2_mouse_sim_byte(bytes[i]);
+	}
+	mouse.update();
+}
+
+bool host_mouse_update(void)
+{
+	mouse.update();
+	return mouse.pending();
+}
+
+void host_control_poll(void)
+{
+	control_poll();
+}
+
+uint32_t host_ring_drops(void)
+{
+	PS2Stats_t stats;
+
+	keyboard.getStats(&stats);
+	return stats.ring_drops;
+}
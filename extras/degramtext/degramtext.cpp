@@ -0,0 +1,411 @@
+/*
+  degramtext.cpp - the degramatyzer, hodor and reverse modes on UTF-8 text
+
+  The degramatyzer only acts on a few characters, so it skips ahead with
+  SIMD to the next one that can start a rule (u h z m, either case, and
+  the lead bytes of ó ą ż) and copies everything in between.  The hodor
+  and reverse modes touch every word and go character by character.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include "degramtext.h"
+
+#include <string.h>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "../../DegramatyzerRules.h"
+
+#define MOD_SHIFT 0x02	// left shift, what the text layout uses
+#define MOD_ALTGR RULE_MOD_ALTGR
+
+struct Key {
+	uint8_t key;		// 0: not typeable, passed through
+	uint8_t modifiers;
+};
+
+static const DegramRule_t rules[] = { DEGRAMATYZER_RULES };
+
+// US layout, as seen from the text
+static const char *const unshifted = "abcdefghijklmnopqrstuvwxyz1234567890";
+static const char *const shifted   = "ABCDEFGHIJKLMNOPQRSTUVWXYZ!@#$%^&*()";
+static const char *const punct     = "-=[]\\;'`,./";     // keys 45..49, 51..56
+static const char *const punct_sh  = "_+{}|:\"~<>?";
+
+// Polish letters on AltGr: key, lower case, upper case
+static const struct {
+	char letter;
+	const char *lower;
+	const char *upper;
+} polish[] = {
+	{ 'a', "\xC4\x85", "\xC4\x84" },	// ą Ą
+	{ 'c', "\xC4\x87", "\xC4\x86" },	// ć Ć
+	{ 'e', "\xC4\x99", "\xC4\x98" },	// ę Ę
+	{ 'l', "\xC5\x82", "\xC5\x81" },	// ł Ł
+	{ 'n', "\xC5\x84", "\xC5\x83" },	// ń Ń
+	{ 'o', "\xC3\xB3", "\xC3\x93" },	// ó Ó
+	{ 's', "\xC5\x9B", "\xC5\x9A" },	// ś Ś
+	{ 'x', "\xC5\xBA", "\xC5\xB9" },	// ź Ź
+	{ 'z', "\xC5\xBC", "\xC5\xBB" },	// ż Ż
+};
+
+struct Layout {
+	Key ascii[128];
+	Key two_byte[2048];		// by the 11 payload bits of a 2 byte sequence
+	char text[256][4][4];		// key, shift | altgr << 1 -> UTF-8, NUL ended
+
+	Layout() {
+		memset(this, 0, sizeof(*this));
+		for (int i = 0; unshifted[i]; i++) {
+			set_ascii(unshifted[i], 4 + i, 0);
+			set_ascii(shifted[i], 4 + i, MOD_SHIFT);
+		}
+		for (int i = 0; punct[i]; i++) {
+			int key = i < 5 ? 45 + i : 46 + i;
+			set_ascii(punct[i], key, 0);
+			set_ascii(punct_sh[i], key, MOD_SHIFT);
+		}
+		set_ascii(' ', 44, 0);
+		set_ascii('\n', 40, 0);
+		set_ascii('\t', 43, 0);
+		for (int key = 0; key < 256; key++) {
+			// AltGr on anything but a Polish letter types the plain key
+			memcpy(text[key][2], text[key][0], 4);
+			memcpy(text[key][3], text[key][1], 4);
+		}
+		for (size_t i = 0; i < sizeof(polish) / sizeof(polish[0]); i++) {
+			uint8_t key = ascii[(int)polish[i].letter].key;
+			set_polish(polish[i].lower, key, MOD_ALTGR);
+			set_polish(polish[i].upper, key, MOD_ALTGR | MOD_SHIFT);
+		}
+	}
+
+	void set_ascii(char c, uint8_t key, uint8_t modifiers) {
+		ascii[(int)c].key = key;
+		ascii[(int)c].modifiers = modifiers;
+		text[key][modifiers ? 1 : 0][0] = c;
+	}
+
+	void set_polish(const char *s, uint8_t key, uint8_t modifiers) {
+		uint8_t *u = (uint8_t *)s;
+		Key &k = two_byte[((u[0] & 0x1F) << 6) | (u[1] & 0x3F)];
+
+		k.key = key;
+		k.modifiers = modifiers;
+		strcpy(text[key][modifier_index(modifiers)], s);
+	}
+
+	static int modifier_index(uint8_t modifiers) {
+		return ((modifiers & RULE_MOD_SHIFT) ? 1 : 0) | ((modifiers & MOD_ALTGR) ? 2 : 0);
+	}
+};
+
+static const Layout layout;
+
+// Decodes the character at p, sets its length
+static inline Key decode(const uint8_t *p, const uint8_t *end, size_t *n)
+{
+	if (p[0] < 0x80) {
+		*n = 1;
+		return layout.ascii[p[0]];
+	}
+	if ((p[0] & 0xE0) == 0xC0 && p + 1 < end && (p[1] & 0xC0) == 0x80) {
+		*n = 2;
+		return layout.two_byte[((p[0] & 0x1F) << 6) | (p[1] & 0x3F)];
+	}
+	// anything else: pass the lead byte and its continuation bytes through
+	size_t i = 1;
+	while (p + i < end && (p[i] & 0xC0) == 0x80 && i < 4) i++;
+	*n = i;
+	Key none = { 0, 0 };
+	return none;
+}
+
+// Decodes the character that ends right before p
+static inline Key decode_before(const uint8_t *start, const uint8_t *p)
+{
+	const uint8_t *q = p - 1;
+	size_t n;
+
+	while (q > start && (*q & 0xC0) == 0x80 && p - q < 4) q--;
+	return decode(q, p, &n);
+}
+
+static inline char *put(char *o, Key k)
+{
+	const char *s = layout.text[k.key][Layout::modifier_index(k.modifiers)];
+
+	while (*s) *o++ = *s++;
+	return o;
+}
+
+// Takes the last character back out of the output, like a backspace
+static inline char *erase(char *start, char *o)
+{
+	if (o == start) return o;
+	do {
+		o--;
+	} while (o > start && ((uint8_t)*o & 0xC0) == 0x80);
+	return o;
+}
+
+
+// Degramatyzer
+
+static inline bool is_trigger(uint8_t b)
+{
+	uint8_t l = b | 0x20;
+
+	return l == 'u' || l == 'h' || l == 'z' || l == 'm' || b == 0xC3 || (b & 0xFE) == 0xC4;
+}
+
+// Copies bytes to o up to the next trigger, returns where it stopped.
+// Whole blocks are stored before they are checked, so up to a block
+// past the end of the copy gets scribbled on; degram_max_output() leaves
+// room for that.
+static inline const uint8_t *copy_to_trigger(const uint8_t *p, const uint8_t *end, char **out)
+{
+	char *o = *out;
+
+#if defined(__AVX2__)
+	const __m256i case_bit = _mm256_set1_epi8(0x20);
+	const __m256i u = _mm256_set1_epi8('u'), h = _mm256_set1_epi8('h');
+	const __m256i z = _mm256_set1_epi8('z'), m = _mm256_set1_epi8('m');
+	const __m256i c3 = _mm256_set1_epi8((char)0xC3), c4 = _mm256_set1_epi8((char)0xC4);
+	const __m256i fe = _mm256_set1_epi8((char)0xFE);
+
+	for (; p + 32 <= end; p += 32, o += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		__m256i l = _mm256_or_si256(v, case_bit);
+		__m256i hit = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(l, u), _mm256_cmpeq_epi8(l, h)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(l, z), _mm256_cmpeq_epi8(l, m)));
+		hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(v, c3),
+			_mm256_cmpeq_epi8(_mm256_and_si256(v, fe), c4)));
+		_mm256_storeu_si256((__m256i *)o, v);
+		uint32_t mask = _mm256_movemask_epi8(hit);
+		if (mask) {
+			*out = o + __builtin_ctz(mask);
+			return p + __builtin_ctz(mask);
+		}
+	}
+#elif defined(__SSE2__)
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+	const __m128i u = _mm_set1_epi8('u'), h = _mm_set1_epi8('h');
+	const __m128i z = _mm_set1_epi8('z'), m = _mm_set1_epi8('m');
+	const __m128i c3 = _mm_set1_epi8((char)0xC3), c4 = _mm_set1_epi8((char)0xC4);
+	const __m128i fe = _mm_set1_epi8((char)0xFE);
+
+	for (; p + 16 <= end; p += 16, o += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i l = _mm_or_si128(v, case_bit);
+		__m128i hit = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(l, u), _mm_cmpeq_epi8(l, h)),
+			_mm_or_si128(_mm_cmpeq_epi8(l, z), _mm_cmpeq_epi8(l, m)));
+		hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, c3),
+			_mm_cmpeq_epi8(_mm_and_si128(v, fe), c4)));
+		_mm_storeu_si128((__m128i *)o, v);
+		uint32_t mask = _mm_movemask_epi8(hit);
+		if (mask) {
+			*out = o + __builtin_ctz(mask);
+			return p + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; p < end && !is_trigger(*p); p++) *o++ = *p;
+	*out = o;
+	return p;
+}
+
+// Rules by key, in rule order; at most two share a key
+struct RuleIndex {
+	int8_t first[256][2];
+
+	RuleIndex() {
+		memset(first, -1, sizeof(first));
+		for (int i = 0; i < DEGRAMATYZER_RULE_COUNT; i++) {
+			int8_t *f = first[rules[i].key];
+			f[f[0] < 0 ? 0 : 1] = i;
+		}
+	}
+};
+
+static const RuleIndex rule_index;
+
+static size_t degramatyzer(const uint8_t *in, size_t len, char *out)
+{
+	const uint8_t *p = in, *end = in + len;
+	char *o = out;
+
+	while (p < end) {
+		p = copy_to_trigger(p, end, &o);
+		if (p == end) break;
+
+		size_t n;
+		Key cur = decode(p, end, &n);
+		Key prev = { 0, 0 };
+		bool have_prev = false;
+		const DegramRule_t *rule = NULL;
+
+		for (int i = 0; i < 2; i++) {
+			int index = rule_index.first[cur.key][i];
+			if (!cur.key || index < 0) break;
+
+			const DegramRule_t *r = &rules[index];
+			if (r->need_altgr && !(cur.modifiers & MOD_ALTGR)) continue;
+			if (r->prev) {
+				if (!have_prev && p > in) prev = decode_before(in, p);
+				have_prev = true;
+				if (r->prev != prev.key) continue;
+			}
+			rule = r;
+			break;
+		}
+		if (!rule) {
+			memcpy(o, p, n);
+			o += n;
+			p += n;
+			continue;
+		}
+
+		uint8_t base = cur.modifiers;
+		if (rule->erase) {
+			o = erase(out, o);
+			base = prev.modifiers;	// erase rules always have a prev
+		}
+		for (int j = 0; j < 2 && rule->out[j]; j++) {
+			Key k = { rule->out[j], degram_rule_modifiers(rule, j, base) };
+			o = put(o, k);
+		}
+		p += n;
+	}
+	return o - out;
+}
+
+
+// Hodor
+
+static const uint8_t hodor[HODOR_SIZE] = { HODOR_WORD };
+
+static size_t hodorifier(const uint8_t *in, size_t len, char *out, bool final)
+{
+	const uint8_t *p = in, *end = in + len;
+	char *o = out;
+	int letter_counter = 0;
+
+	while (p < end) {
+		size_t n;
+		Key cur = decode(p, end, &n);
+
+		if (RULE_IS_LETTER(cur.key)) {
+			if (letter_counter < HODOR_SIZE) {
+				Key k = { hodor[letter_counter++], (uint8_t)(cur.modifiers & ~MOD_ALTGR) };
+				o = put(o, k);
+			}
+		} else {
+			if (letter_counter > 0) {
+				for (; letter_counter < HODOR_SIZE; letter_counter++) {
+					Key k = { hodor[letter_counter], (uint8_t)(cur.modifiers & ~MOD_ALTGR) };
+					o = put(o, k);
+				}
+			}
+			letter_counter = 0;
+			memcpy(o, p, n);
+			o += n;
+		}
+		p += n;
+	}
+	if (final && letter_counter > 0) {
+		for (; letter_counter < HODOR_SIZE; letter_counter++) {
+			Key k = { hodor[letter_counter], 0 };
+			o = put(o, k);
+		}
+	}
+	return o - out;
+}
+
+
+// Reverse: letters of a word in reverse order, but shift stays where it
+// was typed
+
+static char *flush_word(char *o, const std::vector<Key> &word)
+{
+	size_t count = word.size();
+
+	for (size_t i = 0; i < count; i++) {
+		Key k = word[count - 1 - i];
+		k.modifiers = (word[i].modifiers & RULE_MOD_SHIFT) | (k.modifiers & ~RULE_MOD_SHIFT);
+		o = put(o, k);
+	}
+	return o;
+}
+
+static size_t reverser(const uint8_t *in, size_t len, char *out)
+{
+	const uint8_t *p = in, *end = in + len;
+	char *o = out;
+	std::vector<Key> word;
+
+	word.reserve(64);
+	while (p < end) {
+		size_t n;
+		Key cur = decode(p, end, &n);
+
+		if (RULE_IS_LETTER(cur.key)) {
+			word.push_back(cur);
+		} else {
+			o = flush_word(o, word);
+			word.clear();
+			memcpy(o, p, n);
+			o += n;
+		}
+		p += n;
+	}
+	o = flush_word(o, word);
+	return o - out;
+}
+
+
+size_t degram_transform(enum degram_mode mode, const char *in, size_t len,
+			char *out, bool final)
+{
+	const uint8_t *u = (const uint8_t *)in;
+
+	switch (mode) {
+	case DEGRAM_DEGRAMATYZER:
+		return degramatyzer(u, len, out);
+	case DEGRAM_HODOR:
+		return hodorifier(u, len, out, final);
+	case DEGRAM_REVERSE:
+		return reverser(u, len, out);
+	}
+	return 0;
+}
+
+static inline bool is_space(char c)
+{
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+size_t degram_next_cut(const char *in, size_t len, size_t from)
+{
+	for (size_t i = from; i < len; i++) {
+		if (is_space(in[i])) return i + 1;
+	}
+	return len;
+}
+
+size_t degram_last_cut(const char *in, size_t len)
+{
+	for (size_t i = len; i > 0; i--) {
+		if (is_space(in[i - 1])) return i;
+	}
+	return 0;
+}
@@ -0,0 +1,52 @@
+/*
+  degramtext.h - the degramatyzer, hodor and reverse modes on UTF-8 text
+
+  Applies the same rules as the firmware (DegramatyzerRules.h) to text
+  instead of key presses.  Characters are turned into the key and the
+  shift/AltGr state that types them on a Polish (programmer's) layout,
+  run through the rules, and turned back.  Characters the layout can't
+  type are passed through and end words like any other non-letter.
+
+  Text can be cut into chunks right after an ASCII whitespace byte and
+  the chunks transformed independently: no rule looks across
+  whitespace.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef degramtext_h
+#define degramtext_h
+
+#include <stddef.h>
+
+enum degram_mode {
+	DEGRAM_DEGRAMATYZER,
+	DEGRAM_HODOR,
+	DEGRAM_REVERSE
+};
+
+// Output can be this much longer than the input, plus some room for
+// block stores past the end
+static inline size_t degram_max_output(size_t len)
+{
+	return 3 * len + 64;
+}
+
+// Transforms in[0, len) into out, which must hold degram_max_output(len)
+// bytes, and returns the output length.  The input must start at the
+// beginning of the text or right after whitespace.  `final` marks the
+// end of the text, where an unfinished hodor word gets completed.
+size_t degram_transform(enum degram_mode mode, const char *in, size_t len,
+			char *out, bool final);
+
+// The first chunk boundary at or after `from`, i.e. the position after
+// the next whitespace byte, or len if there is none
+size_t degram_next_cut(const char *in, size_t len, size_t from);
+
+// The last chunk boundary in in[0, len), or 0 if there is none
+size_t degram_last_cut(const char *in, size_t len);
+
+#endif
@@ -0,0 +1,289 @@
+/*
+  degramtext - runs the Degramatyzer's text modes over files and pipes
+
+  Build:  g++ -O3 -march=native -pthread -o degramtext main.cpp degramtext.cpp
+
+  Usage:  degramtext [-m degramatyzer|hodor|reverse] [-j threads] [-s] [file]
+          degramtext --bench megabytes [-j threads]
+
+  Reads the file (memory mapped) or stdin and writes the result to
+  stdout.  The input is handled in windows of WINDOW_PER_THREAD bytes per
+  thread, cut at whitespace, and the pieces of a window are transformed
+  in parallel.  -s prints the throughput to stderr.  --bench builds a
+  corpus of the given size in memory and times every mode on it.
+  -j takes 1 to MAX_THREADS, --bench 1 to MAX_BENCH_MB.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "degramtext.h"
+
+#define WINDOW_PER_THREAD (16 << 20)
+#define MAX_THREADS 256		// -j, each one holds a window
+#define MAX_BENCH_MB 16384	// --bench corpus, held in memory
+
+struct Piece {
+	const char *in;
+	size_t len;
+	bool final;
+	std::vector<char> out;
+	size_t out_len;
+};
+
+static enum degram_mode mode = DEGRAM_DEGRAMATYZER;
+static unsigned threads = 1;
+static bool discard_output = false;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool write_all(const char *p, size_t len)
+{
+	while (len) {
+		ssize_t n = write(1, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void run_piece(Piece *piece)
+{
+	size_t need = degram_max_output(piece->len);
+
+	if (piece->out.size() < need) piece->out.resize(need);
+	piece->out_len = degram_transform(mode, piece->in, piece->len,
+					  piece->out.data(), piece->final);
+}
+
+// Transforms a window that starts at a cut and ends at one (or at the end
+// of the text, `final`), split over the threads.  Returns the output size.
+static size_t run_window(std::vector<Piece> &pieces, const char *in, size_t len, bool final)
+{
+	std::vector<std::thread> workers;
+	size_t start = 0, total = 0;
+	unsigned n = 0;
+
+	for (unsigned i = 0; i < threads && start < len; i++) {
+		size_t end = i + 1 == threads ? len : degram_next_cut(in, len, len * (i + 1) / threads);
+		if (end <= start) continue;
+		pieces[n].in = in + start;
+		pieces[n].len = end - start;
+		pieces[n].final = final && end == len;
+		n++;
+		start = end;
+	}
+	for (unsigned i = 1; i < n; i++) workers.push_back(std::thread(run_piece, &pieces[i]));
+	if (n) run_piece(&pieces[0]);
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+
+	for (unsigned i = 0; i < n; i++) {
+		total += pieces[i].out_len;
+		if (!discard_output && !write_all(pieces[i].out.data(), pieces[i].out_len)) {
+			perror("write");
+			exit(1);
+		}
+	}
+	return total;
+}
+
+static size_t run_mapped(const char *data, size_t size)
+{
+	std::vector<Piece> pieces(threads);
+	size_t window = (size_t)WINDOW_PER_THREAD * threads;
+	size_t offset = 0, out = 0;
+
+	while (offset < size) {
+		size_t len = size - offset;
+		bool final = true;
+
+		if (len > window) {
+			len = degram_next_cut(data + offset, size - offset, window);
+			final = offset + len == size;
+		}
+		out += run_window(pieces, data + offset, len, final);
+		offset += len;
+	}
+	return out;
+}
+
+static size_t run_stream(int fd, size_t *in_total)
+{
+	std::vector<Piece> pieces(threads);
+	std::vector<char> buf((size_t)WINDOW_PER_THREAD * threads);
+	size_t have = 0, out = 0;
+
+	*in_total = 0;
+	for (;;) {
+		if (have == buf.size()) buf.resize(buf.size() * 2);   // no whitespace yet
+		ssize_t n = read(fd, buf.data() + have, buf.size() - have);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("read");
+			exit(1);
+		}
+		if (n == 0) break;
+		have += n;
+		*in_total += n;
+		if (have < buf.size()) continue;
+
+		size_t cut = degram_last_cut(buf.data(), have);
+		if (!cut) continue;
+		out += run_window(pieces, buf.data(), cut, false);
+		memmove(buf.data(), buf.data() + cut, have - cut);
+		have -= cut;
+	}
+	out += run_window(pieces, buf.data(), have, true);
+	return out;
+}
+
+static void report(const char *what, size_t in, size_t out, double seconds)
+{
+	fprintf(stderr, "%s: %zu bytes in, %zu out, %.3f s, %.2f GB/s\n",
+		what, in, out, seconds, seconds > 0 ? in / seconds / 1e9 : 0.0);
+}
+
+// Polish text with plenty of rule hits, repeated up to the size
+static std::string make_corpus(size_t size)
+{
+	static const char *const sample =
+		"Chrząszcz brzmi w trzcinie w Szczebrzeszynie, z którego słynie.\n"
+		"Wóz tu, wóz tam, a rzeka huczy pod mostem; chłopi robią wszystko, "
+		"co mogą, żeby zdążyć przed zmrokiem.\n"
+		"Hodor! Hodor? HODOR hodor, 1234 ąęłńóśźż ĄĘŁŃÓŚŹŻ.\n";
+	std::string corpus;
+	size_t n = strlen(sample);
+
+	corpus.reserve(size + n);
+	while (corpus.size() < size) corpus.append(sample, n);
+	corpus.resize(size);
+	return corpus;
+}
+
+static int bench(size_t megabytes)
+{
+	static const struct { enum degram_mode mode; const char *name; } modes[] = {
+		{ DEGRAM_DEGRAMATYZER, "degramatyzer" },
+		{ DEGRAM_HODOR, "hodor" },
+		{ DEGRAM_REVERSE, "reverse" },
+	};
+	std::string corpus = make_corpus(megabytes << 20);
+
+	discard_output = true;
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		mode = modes[i].mode;
+		double start = now_s();
+		size_t out = run_mapped(corpus.data(), corpus.size());
+		report(modes[i].name, corpus.size(), out, now_s() - start);
+	}
+	return 0;
+}
+
+// A whole decimal number from 1 to max, or -1
+static long parse_count(const char *s, long max)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (errno || end == s || *end || v < 1 || v > max) return -1;
+	return v;
+}
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"usage: degramtext [-m degramatyzer|hodor|reverse] [-j threads] [-s] [file]\n"
+		"       degramtext --bench megabytes [-j threads]\n");
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	const char *file = NULL;
+	bool stats = false;
+	size_t bench_mb = 0;
+
+	threads = std::thread::hardware_concurrency();
+	if (!threads) threads = 1;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+			const char *m = argv[++i];
+			if (!strcmp(m, "degramatyzer")) mode = DEGRAM_DEGRAMATYZER;
+			else if (!strcmp(m, "hodor")) mode = DEGRAM_HODOR;
+			else if (!strcmp(m, "reverse")) mode = DEGRAM_REVERSE;
+			else return usage();
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			long n = parse_count(argv[++i], MAX_THREADS);
+			if (n < 0) return usage();
+			threads = n;
+		} else if (!strcmp(argv[i], "-s")) {
+			stats = true;
+		} else if (!strcmp(argv[i], "--bench") && i + 1 < argc) {
+			long n = parse_count(argv[++i], MAX_BENCH_MB);
+			if (n < 0) return usage();
+			bench_mb = n;
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			return usage();
+		} else {
+			file = argv[i];
+		}
+	}
+	if (bench_mb) return bench(bench_mb);
+
+	double start = now_s();
+	size_t in = 0, out;
+	int fd = 0;
+	struct stat st;
+
+	if (file && strcmp(file, "-")) {
+		fd = open(file, O_RDONLY);
+		if (fd < 0) {
+			perror(file);
+			return 1;
+		}
+	}
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		in = st.st_size;
+		void *data = mmap(NULL, in, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			perror("mmap");
+			return 1;
+		}
+		madvise(data, in, MADV_SEQUENTIAL);
+		out = run_mapped((const char *)data, in);
+		munmap(data, in);
+	} else {
+		out = run_stream(fd, &in);
+	}
+	if (stats) report("total", in, out, now_s() - start);
+	return 0;
+}
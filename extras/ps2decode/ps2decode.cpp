@@ -0,0 +1,523 @@
+/*
+  ps2decode - decodes logic analyzer captures of the PS/2 keyboard bus
+
+  Build:  g++ -O3 -march=native -pthread -o ps2decode ps2decode.cpp
+
+  Usage:  ps2decode -r rate [-f sigrok|packed] [-u unitsize] [-c clock]
+                    [-d data] [-j threads] [-b scancodes.bin] [-q] capture
+          ps2decode --bench megabytes [-j threads]
+
+  Capture formats:
+    sigrok  sigrok's "binary" output: unitsize bytes per sample, channel
+            n in bit n.  -c and -d pick the clock and data channels
+            (default 0 and 1).
+    packed  blocks of two little-endian 64 bit words, clock then data,
+            one sample per bit, bit 0 first.
+
+  The keyboard changes data while the clock is high and the receiver
+  samples it on the falling clock edge, as the frame ISR does.  Each
+  frame is then checked like the firmware does (start, stop, odd
+  parity) and on top of that for timing: every bit must come PS2_BIT_MIN_US
+  to PS2_BIT_MAX_US after the one before, and a longer gap ends the frame
+  (the host inhibiting, or a frame cut short).
+
+  Every frame is listed on stdout, time in microseconds, scan code and
+  what is wrong with it:
+     S  start or stop bit wrong      P  parity wrong
+     T  a bit came too soon          C  cut short, only the bits so far
+  -b writes the scan codes of the good frames, one byte each: the stream
+  ps2_sim_scan_code() takes, so a capture can be replayed through the
+  simulated frame source.
+
+  The capture is memory mapped and searched for falling clock edges in
+  parallel, 64 samples at a time with SIMD compares or plain bit
+  operations; the edges, a tiny fraction of the samples, are then put
+  together into frames in order.  SIMD covers sigrok unitsizes 1, 2 and
+  4 and packed captures; other unitsizes go through the 64 samples one
+  at a time, which is slower but decodes the same.
+
+  -j takes 1 to MAX_THREADS, --bench 1 to MAX_BENCH_MB.  -r is the
+  sample rate in Hz, a plain number such as 2e6 up to MAX_RATE.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Frame layout as in PS2FrameSource.h: bit 0 is the first bit on the wire
+#define PS2_FRAME_BITS	11
+
+// PS/2 clocks at 10 to 16.7 kHz, i.e. 60 to 100 us a bit
+#define PS2_BIT_MIN_US	40
+#define PS2_BIT_MAX_US	120
+
+#define MAX_THREADS	256
+#define MAX_BENCH_MB	16384	// --bench capture, held in memory
+#define MAX_UNITSIZE	8	// sigrok's limit, 64 channels
+#define MAX_RATE	1e10	// samples per second
+
+#define FLAG_START_STOP	0x01
+#define FLAG_PARITY	0x02
+#define FLAG_TIMING	0x04
+#define FLAG_CUT	0x08
+
+enum format { FORMAT_SIGROK, FORMAT_PACKED };
+
+struct Capture {
+	const uint8_t *data;
+	size_t size;
+	enum format format;
+	unsigned unitsize;
+	unsigned clock, data_ch;
+	uint64_t samples;
+};
+
+// A falling clock edge: sample number << 1 | data bit
+typedef uint64_t Edge;
+
+struct Stats {
+	uint64_t edges;
+	uint64_t frames;
+	uint64_t good;
+	uint64_t start_stop, parity, timing, cut;
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline unsigned sample_bit(const Capture *cap, uint64_t i, unsigned ch)
+{
+	if (cap->format == FORMAT_PACKED) {
+		const uint8_t *block = cap->data + (i / 64) * 16 + (ch ? 8 : 0);
+		return (block[(i % 64) / 8] >> (i % 8)) & 1;
+	}
+	return (cap->data[i * cap->unitsize + ch / 8] >> (ch % 8)) & 1;
+}
+
+// Clock and data of 64 samples from a sigrok capture with one byte per
+// sample, bit n of the masks being sample n
+static inline void sigrok_masks(const uint8_t *p, unsigned clock, unsigned data,
+				uint64_t *clk, uint64_t *dat)
+{
+#if defined(__AVX2__)
+	__m256i lo = _mm256_loadu_si256((const __m256i *)p);
+	__m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+	__m128i cs = _mm_cvtsi32_si128(7 - clock), ds = _mm_cvtsi32_si128(7 - data);
+
+	// move the channel's bit to the top of each byte, where movemask looks
+	*clk = (uint32_t)_mm256_movemask_epi8(_mm256_sll_epi16(lo, cs)) |
+	       (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_sll_epi16(hi, cs)) << 32;
+	*dat = (uint32_t)_mm256_movemask_epi8(_mm256_sll_epi16(lo, ds)) |
+	       (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_sll_epi16(hi, ds)) << 32;
+#elif defined(__SSE2__)
+	__m128i cs = _mm_cvtsi32_si128(7 - clock), ds = _mm_cvtsi32_si128(7 - data);
+
+	*clk = 0;
+	*dat = 0;
+	for (int i = 0; i < 4; i++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+		*clk |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_sll_epi16(v, cs)) << (16 * i);
+		*dat |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_sll_epi16(v, ds)) << (16 * i);
+	}
+#else
+	*clk = 0;
+	*dat = 0;
+	for (int i = 0; i < 64; i++) {
+		*clk |= (uint64_t)((p[i] >> clock) & 1) << i;
+		*dat |= (uint64_t)((p[i] >> data) & 1) << i;
+	}
+#endif
+}
+
+// The same for any unitsize.  Channel n is bit n of a little-endian
+// word, so with 2 or 4 bytes a sample the channel's bit is moved to the
+// top of its 16 or 32 bit lane, spread over the lane with an arithmetic
+// shift and the lanes packed down to bytes for movemask.
+static inline uint64_t unit_mask(const uint8_t *p, unsigned unitsize, unsigned ch)
+{
+	uint64_t mask = 0;
+
+#if defined(__SSE2__)
+	if (unitsize == 2) {
+		__m128i s = _mm_cvtsi32_si128(15 - ch);
+
+		for (int i = 0; i < 4; i++) {
+			__m128i a = _mm_loadu_si128((const __m128i *)(p + 32 * i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(p + 32 * i + 16));
+			a = _mm_srai_epi16(_mm_sll_epi16(a, s), 15);
+			b = _mm_srai_epi16(_mm_sll_epi16(b, s), 15);
+			mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_packs_epi16(a, b)) << (16 * i);
+		}
+		return mask;
+	}
+	if (unitsize == 4) {
+		__m128i s = _mm_cvtsi32_si128(31 - ch);
+
+		for (int i = 0; i < 4; i++) {
+			__m128i v[4];
+			for (int j = 0; j < 4; j++) {
+				v[j] = _mm_loadu_si128((const __m128i *)(p + 64 * i + 16 * j));
+				v[j] = _mm_srai_epi32(_mm_sll_epi32(v[j], s), 31);
+			}
+			__m128i w = _mm_packs_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+			mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(w) << (16 * i);
+		}
+		return mask;
+	}
+#endif
+	p += ch / 8;
+	for (int i = 0; i < 64; i++) mask |= (uint64_t)((p[i * unitsize] >> (ch % 8)) & 1) << i;
+	return mask;
+}
+
+static inline void add_edges(std::vector<Edge> &edges, uint64_t base,
+			     uint64_t falling, uint64_t dat)
+{
+	while (falling) {
+		unsigned i = __builtin_ctzll(falling);
+		edges.push_back((base + i) << 1 | ((dat >> i) & 1));
+		falling &= falling - 1;
+	}
+}
+
+// Falling clock edges in samples [from, to), `from` a multiple of 64.
+// A falling edge is a low sample after a high one.
+static void find_edges(const Capture *cap, uint64_t from, uint64_t to, std::vector<Edge> *edges)
+{
+	uint64_t prev = from ? sample_bit(cap, from - 1, cap->clock) : 1;	// idle is high
+	uint64_t i = from;
+
+	if (cap->format == FORMAT_PACKED) {
+		for (; i + 64 <= to; i += 64) {
+			uint64_t clk, dat;
+			memcpy(&clk, cap->data + (i / 64) * 16, 8);
+			memcpy(&dat, cap->data + (i / 64) * 16 + 8, 8);
+			add_edges(*edges, i, ~clk & (clk << 1 | prev), dat);
+			prev = clk >> 63;
+		}
+	} else if (cap->unitsize == 1) {
+		for (; i + 64 <= to; i += 64) {
+			uint64_t clk, dat;
+			sigrok_masks(cap->data + i, cap->clock, cap->data_ch, &clk, &dat);
+			add_edges(*edges, i, ~clk & (clk << 1 | prev), dat);
+			prev = clk >> 63;
+		}
+	} else {
+		for (; i + 64 <= to; i += 64) {
+			const uint8_t *p = cap->data + i * cap->unitsize;
+			uint64_t clk = unit_mask(p, cap->unitsize, cap->clock);
+			uint64_t dat = unit_mask(p, cap->unitsize, cap->data_ch);
+			add_edges(*edges, i, ~clk & (clk << 1 | prev), dat);
+			prev = clk >> 63;
+		}
+	}
+	for (; i < to; i++) {
+		uint64_t clk = sample_bit(cap, i, cap->clock);
+		if (prev && !clk) edges->push_back(i << 1 | sample_bit(cap, i, cap->data_ch));
+		prev = clk;
+	}
+}
+
+// Puts the edges together into frames, in order
+class Framer {
+  public:
+	Framer(double rate, FILE *list, FILE *codes, Stats *stats)
+		: list(list), codes(codes), stats(stats), rate(rate),
+		  start(0), last(0), frame(0), bits(0), flags(0) {
+		min_gap = (uint64_t)(rate * PS2_BIT_MIN_US / 1e6);
+		max_gap = (uint64_t)(rate * PS2_BIT_MAX_US / 1e6 + 0.5);
+	}
+
+	void edge(Edge e) {
+		uint64_t t = e >> 1;
+
+		stats->edges++;
+		if (bits && t - last > max_gap) {
+			emit(FLAG_CUT);
+		}
+		if (bits && t - last < min_gap) flags |= FLAG_TIMING;
+		if (!bits) start = t;
+		frame |= (uint16_t)(e & 1) << bits;
+		last = t;
+		if (++bits == PS2_FRAME_BITS) emit(0);
+	}
+
+	void finish(void) {
+		if (bits) emit(FLAG_CUT);
+	}
+
+  private:
+	void emit(uint8_t more) {
+		uint8_t scan_code = (frame >> 1) & 0xFF;
+
+		flags |= more;
+		if (!(flags & FLAG_CUT)) {
+			if ((frame & 1) || !(frame & (1 << 10))) flags |= FLAG_START_STOP;
+			if (!__builtin_parity(frame & 0x3FE)) flags |= FLAG_PARITY;
+		}
+		stats->frames++;
+		if (!flags) {
+			stats->good++;
+			if (codes) putc(scan_code, codes);
+		}
+		if (flags & FLAG_START_STOP) stats->start_stop++;
+		if (flags & FLAG_PARITY) stats->parity++;
+		if (flags & FLAG_TIMING) stats->timing++;
+		if (flags & FLAG_CUT) stats->cut++;
+		if (list) {
+			fprintf(list, "%14.1f  ", start * 1e6 / rate);
+			if (flags & FLAG_CUT) fprintf(list, "--  C %u bits", bits);
+			else fprintf(list, "%02X", scan_code);
+			if (flags & ~FLAG_CUT) {
+				fprintf(list, "  %s%s%s", flags & FLAG_START_STOP ? "S" : "",
+					flags & FLAG_PARITY ? "P" : "", flags & FLAG_TIMING ? "T" : "");
+			}
+			putc('\n', list);
+		}
+		bits = 0;
+		frame = 0;
+		flags = 0;
+	}
+
+	FILE *list, *codes;
+	Stats *stats;
+	double rate;
+	uint64_t min_gap, max_gap;
+	uint64_t start, last;
+	uint16_t frame;
+	uint8_t bits, flags;
+};
+
+static double decode(const Capture *cap, unsigned threads, double rate,
+		     FILE *list, FILE *codes, Stats *stats)
+{
+	std::vector<std::vector<Edge> > edges(threads);
+	std::vector<std::thread> workers;
+	double start = now_s();
+
+	for (unsigned t = 0; t < threads; t++) {
+		// chunks on 64 sample boundaries, the last one takes the rest
+		uint64_t from = cap->samples * t / threads / 64 * 64;
+		uint64_t to = t + 1 == threads ? cap->samples : cap->samples * (t + 1) / threads / 64 * 64;
+		workers.push_back(std::thread(find_edges, cap, from, to, &edges[t]));
+	}
+	for (unsigned t = 0; t < threads; t++) workers[t].join();
+
+	Framer framer(rate, list, codes, stats);
+	for (unsigned t = 0; t < threads; t++) {
+		for (size_t i = 0; i < edges[t].size(); i++) framer.edge(edges[t][i]);
+	}
+	framer.finish();
+	return now_s() - start;
+}
+
+static void report(const Capture *cap, const Stats *stats, double seconds)
+{
+	fprintf(stderr, "%llu samples, %llu falling edges, %llu frames, %llu good; "
+		"errors: %llu start/stop, %llu parity, %llu timing, %llu cut short\n",
+		(unsigned long long)cap->samples, (unsigned long long)stats->edges,
+		(unsigned long long)stats->frames, (unsigned long long)stats->good,
+		(unsigned long long)stats->start_stop, (unsigned long long)stats->parity,
+		(unsigned long long)stats->timing, (unsigned long long)stats->cut);
+	fprintf(stderr, "%zu bytes in %.3f s, %.2f GB/s\n", cap->size, seconds,
+		seconds > 0 ? cap->size / seconds / 1e9 : 0.0);
+}
+
+// A sigrok capture at 2 MHz of a keyboard sending frames back to back
+// at 12.5 kHz, every tenth frame with bad parity
+static std::string make_capture(size_t size, uint64_t *frames)
+{
+	const unsigned half_bit = 80, gap = 400;	// samples
+	std::string cap(size, '\x03');
+	size_t pos = gap;
+	uint8_t code = 0x1C;
+
+	*frames = 0;
+	while (pos + PS2_FRAME_BITS * 2 * half_bit + gap <= size) {
+		uint16_t frame = (uint16_t)code << 1 | 1 << 10;
+		if (!__builtin_parity(code)) frame |= 1 << 9;
+		if (*frames % 10 == 9) frame ^= 1 << 9;
+		for (int b = 0; b < PS2_FRAME_BITS; b++) {
+			uint8_t d = (frame >> b) & 1;
+			for (unsigned i = 0; i < half_bit; i++) cap[pos++] = 0x01 | d << 1;
+			for (unsigned i = 0; i < half_bit; i++) cap[pos++] = 0x00 | d << 1;
+		}
+		for (unsigned i = 0; i < gap; i++) cap[pos++] = 0x03;
+		code = code * 5 + 1;
+		(*frames)++;
+	}
+	return cap;
+}
+
+static int bench(size_t megabytes, unsigned threads)
+{
+	uint64_t frames;
+	std::string data = make_capture(megabytes << 20, &frames);
+	Capture cap = { (const uint8_t *)data.data(), data.size(), FORMAT_SIGROK, 1, 0, 1, data.size() };
+	Stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+	double seconds = decode(&cap, threads, 2e6, NULL, NULL, &stats);
+	report(&cap, &stats, seconds);
+	if (stats.frames != frames || stats.parity != frames / 10 || stats.good + stats.parity != frames) {
+		fprintf(stderr, "expected %llu frames, %llu with bad parity\n",
+			(unsigned long long)frames, (unsigned long long)(frames / 10));
+		return 1;
+	}
+	return 0;
+}
+
+static long parse_count(const char *s, long min, long max)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (errno || end == s || *end || v < min || v > max) return -1;
+	return v;
+}
+
+// Sample rate, 0 if it is not a number in (0, MAX_RATE]
+static double parse_rate(const char *s)
+{
+	char *end;
+	double v;
+
+	errno = 0;
+	v = strtod(s, &end);
+	if (errno || end == s || *end || !(v > 0 && v <= MAX_RATE)) return 0;
+	return v;
+}
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"usage: ps2decode -r rate [-f sigrok|packed] [-u unitsize] [-c clock] [-d data]\n"
+		"                 [-j threads] [-b scancodes.bin] [-q] capture\n"
+		"       ps2decode --bench megabytes [-j threads]\n");
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	Capture cap;
+	const char *file = NULL, *codes_path = NULL;
+	double rate = 0;
+	bool quiet = false;
+	size_t bench_mb = 0;
+	unsigned threads = std::thread::hardware_concurrency();
+
+	if (!threads) threads = 1;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+	memset(&cap, 0, sizeof(cap));
+	cap.format = FORMAT_SIGROK;
+	cap.unitsize = 1;
+	cap.clock = 0;
+	cap.data_ch = 1;
+
+	for (int i = 1; i < argc; i++) {
+		const char *a = argv[i];
+		bool more = i + 1 < argc;
+		long n;
+
+		if (!strcmp(a, "-r") && more) {
+			if ((rate = parse_rate(argv[++i])) == 0) return usage();
+		}
+		else if (!strcmp(a, "-f") && more) {
+			const char *f = argv[++i];
+			if (!strcmp(f, "sigrok")) cap.format = FORMAT_SIGROK;
+			else if (!strcmp(f, "packed")) cap.format = FORMAT_PACKED;
+			else return usage();
+		}
+		else if (!strcmp(a, "-u") && more) {
+			if ((n = parse_count(argv[++i], 1, MAX_UNITSIZE)) < 0) return usage();
+			cap.unitsize = n;
+		}
+		else if (!strcmp(a, "-c") && more) {
+			if ((n = parse_count(argv[++i], 0, MAX_UNITSIZE * 8 - 1)) < 0) return usage();
+			cap.clock = n;
+		}
+		else if (!strcmp(a, "-d") && more) {
+			if ((n = parse_count(argv[++i], 0, MAX_UNITSIZE * 8 - 1)) < 0) return usage();
+			cap.data_ch = n;
+		}
+		else if (!strcmp(a, "-j") && more) {
+			if ((n = parse_count(argv[++i], 1, MAX_THREADS)) < 0) return usage();
+			threads = n;
+		}
+		else if (!strcmp(a, "-b") && more) codes_path = argv[++i];
+		else if (!strcmp(a, "-q")) quiet = true;
+		else if (!strcmp(a, "--bench") && more) {
+			if ((n = parse_count(argv[++i], 1, MAX_BENCH_MB)) < 0) return usage();
+			bench_mb = n;
+		}
+		else if (a[0] == '-') return usage();
+		else file = a;
+	}
+	if (bench_mb) return bench(bench_mb, threads);
+	if (!file || rate <= 0) return usage();
+	if (cap.format == FORMAT_PACKED) {
+		cap.clock = 0;
+		cap.data_ch = 1;
+	} else if (cap.clock >= cap.unitsize * 8 || cap.data_ch >= cap.unitsize * 8) {
+		fprintf(stderr, "channels must be below %u\n", cap.unitsize * 8);
+		return 2;
+	}
+
+	int fd = open(file, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(file);
+		return 1;
+	}
+	cap.size = st.st_size;
+	cap.samples = cap.format == FORMAT_PACKED ? cap.size / 16 * 64 : cap.size / cap.unitsize;
+	if (cap.size) {
+		void *data = mmap(NULL, cap.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			perror("mmap");
+			return 1;
+		}
+		madvise(data, cap.size, MADV_SEQUENTIAL);
+		cap.data = (const uint8_t *)data;
+	}
+
+	FILE *codes = NULL;
+	if (codes_path && !(codes = fopen(codes_path, "wb"))) {
+		perror(codes_path);
+		return 1;
+	}
+
+	Stats stats;
+	memset(&stats, 0, sizeof(stats));
+	double seconds = decode(&cap, threads, rate, quiet ? NULL : stdout, codes, &stats);
+	report(&cap, &stats, seconds);
+	if (codes) fclose(codes);
+	return 0;
+}
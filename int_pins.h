@@ -63,3 +63,50 @@
 #endif
 #endif
 
+
+// PS/2 frame source, i.e. how the 11-bit frames of the keyboard get
+// into the scan code buffer.  Override by defining PS2_FRAME_SOURCE for
+// the whole build; the library's .cpp files are compiled on their own,
+// so a #define in the sketch does not reach them.  With arduino-cli:
+//   --build-property "compiler.cpp.extra_flags=-DPS2_FRAME_SOURCE=1"
+// or the same compiler.cpp.extra_flags line in platform.local.txt.
+//
+//   PS2_FRAME_SOURCE_EDGE  one interrupt on every falling clock edge,
+//                          works on every board above (default)
+//   PS2_FRAME_SOURCE_SPI   the SPI peripheral runs as a slave clocked by
+//                          the keyboard and shifts in whole frames, one
+//                          interrupt per byte.  Needs CORE_PS2_SPI_SLAVE.
+//   PS2_FRAME_SOURCE_SIM   no hardware, frames are fed by software
+//                          through ps2_sim_scan_code()
+#define PS2_FRAME_SOURCE_EDGE  0
+#define PS2_FRAME_SOURCE_SPI   1
+#define PS2_FRAME_SOURCE_SIM   2
+
+// Teensy 3.0 / 3.1 / 3.2: SPI0 in slave mode, 11 bit frames.
+// Keyboard clock goes to SCK (pin 14), keyboard data to DIN (pin 12),
+// and CS0 (pin 10) must be wired to PS2_SPI_CS_PIN, which the driver
+// pulses to realign the frame counter after a bad frame.  The pins
+// passed to begin() are ignored, the pin mux fixes them.
+#if defined(__MK20DX128__) || defined(__MK20DX256__)
+  #define CORE_PS2_SPI_SLAVE
+  #define PS2_SPI_SCK_PIN     14
+  #define PS2_SPI_SCK_CONFIG  CORE_PIN14_CONFIG
+  #ifndef PS2_SPI_CS_PIN
+  #define PS2_SPI_CS_PIN  9
+  #endif
+#endif
+
+#ifndef PS2_FRAME_SOURCE
+  #define PS2_FRAME_SOURCE  PS2_FRAME_SOURCE_EDGE
+#endif
+
+// The Teensy 3.x / LC / 4.x cores keep the mouse buttons that move()
+// sends in usb_mouse_buttons_state, so buttons and motion can go out in
+// one report.  On the others set_buttons() sends a report of its own.
+#if defined(TEENSYDUINO) && defined(__arm__) && !defined(CORE_MOUSE_BUTTONS_STATE)
+  #define CORE_MOUSE_BUTTONS_STATE
+#endif
+
+#if PS2_FRAME_SOURCE == PS2_FRAME_SOURCE_SPI && !defined(CORE_PS2_SPI_SLAVE)
+  #error "PS2_FRAME_SOURCE_SPI is not supported on this board"
+#endif